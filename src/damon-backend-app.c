@@ -15,215 +15,1359 @@
 
 
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
 #include "rrd.h"
 #include "damon.h"
+#include "snapshot.h"
+#include "../data/DaMon.h"
 #include "../config.h"
 
 /* constants */
+#ifndef APPSERVER_DAMON_NAME
+# define APPSERVER_DAMON_NAME	"DaMon"
+#endif
 #ifndef APPSERVER_PROBE_NAME
 # define APPSERVER_PROBE_NAME	PACKAGE
 #endif
 #ifndef PROGNAME_DAMON
 # define PROGNAME_DAMON		"DaMon"
 #endif
+#define DAMON_BACKOFF_SHIFT_MAX	6
+#define DAMON_RESOLVE_TTL	300
+
+
+/* DaMonBackend */
+/* private */
+/* types */
+struct _App
+{
+	DaMonBackend * backend;
+};
+
+struct _DaMonBackend
+{
+	DaMon * damon;
+
+	/* workers */
+	pthread_t * threads;
+	size_t threads_cnt;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool quit;
+
+	/* hosts queued for polling */
+	DaMonHost ** queue;
+	size_t queue_size;
+	size_t queue_pos;
+	size_t queue_cnt;
+
+	/* hosts done polling */
+	int fds[2];
+
+	/* snapshots pushed by the hosts */
+	App app;
+	AppServer * appserver;
+};
+
+
+/* prototypes */
+static void * _backend_thread(void * data);
+static int _backend_on_done(int fd, DaMonBackend * backend);
+
+
+/* public */
+/* functions */
+/* damon_backend_new */
+DaMonBackend * damon_backend_new(DaMon * damon)
+{
+	DaMonBackend * backend;
+	size_t cnt;
+
+	if((backend = object_new(sizeof(*backend))) == NULL)
+		return NULL;
+	backend->damon = damon;
+	backend->threads = NULL;
+	backend->threads_cnt = 0;
+	backend->quit = false;
+	backend->app.backend = backend;
+	backend->appserver = NULL;
+	srandom(time(NULL) ^ getpid());
+	for(cnt = 0; damon_get_host_by_id(damon, cnt) != NULL; cnt++);
+	backend->queue = (cnt > 0) ? malloc(sizeof(*backend->queue) * cnt)
+		: NULL;
+	backend->queue_size = cnt;
+	backend->queue_pos = 0;
+	backend->queue_cnt = 0;
+	if(cnt > damon_get_concurrency(damon))
+		cnt = damon_get_concurrency(damon);
+	if(cnt > 0)
+		backend->threads = malloc(sizeof(*backend->threads) * cnt);
+	if((backend->queue_size > 0 && (backend->queue == NULL
+					|| backend->threads == NULL))
+			|| pipe(backend->fds) != 0)
+	{
+		damon_perror(NULL, 1);
+		free(backend->threads);
+		free(backend->queue);
+		object_delete(backend);
+		return NULL;
+	}
+	pthread_mutex_init(&backend->mutex, NULL);
+	pthread_cond_init(&backend->cond, NULL);
+	for(; backend->threads_cnt < cnt; backend->threads_cnt++)
+		if((errno = pthread_create(&backend->threads[
+							backend->threads_cnt],
+						NULL, _backend_thread, backend))
+				!= 0)
+		{
+			damon_perror("pthread_create", 1);
+			break;
+		}
+	if(backend->threads_cnt == 0 && cnt > 0)
+	{
+		damon_backend_delete(backend);
+		return NULL;
+	}
+	event_register_io_read(damon_get_event(damon), backend->fds[0],
+			(EventIOFunc)_backend_on_done, backend);
+	/* keep polling if the snapshots cannot be pushed */
+	if(damon_get_push(damon) != NULL
+			&& (backend->appserver = appserver_new_event(
+					&backend->app, 0, APPSERVER_DAMON_NAME,
+					damon_get_listen(damon),
+					damon_get_event(damon))) == NULL)
+		damon_serror();
+	return backend;
+}
+
+
+/* damon_backend_delete */
+static void _backend_unsubscribe(DaMonBackend * backend);
+static int _refresh_call(DaMonHost * host, void ** result,
+		char const * method, ...);
+static void _refresh_subscribed(DaMonHost * host, bool subscribed);
+
+void damon_backend_delete(DaMonBackend * backend)
+{
+	size_t i;
+
+	pthread_mutex_lock(&backend->mutex);
+	backend->quit = true;
+	pthread_cond_broadcast(&backend->cond);
+	pthread_mutex_unlock(&backend->mutex);
+	for(i = 0; i < backend->threads_cnt; i++)
+		pthread_join(backend->threads[i], NULL);
+	if(backend->appserver != NULL)
+	{
+		_backend_unsubscribe(backend);
+		appserver_delete(backend->appserver);
+	}
+	event_unregister_io_read(damon_get_event(backend->damon),
+			backend->fds[0]);
+	close(backend->fds[0]);
+	close(backend->fds[1]);
+	pthread_cond_destroy(&backend->cond);
+	pthread_mutex_destroy(&backend->mutex);
+	free(backend->threads);
+	free(backend->queue);
+	object_delete(backend);
+}
+
+
+static void _backend_unsubscribe(DaMonBackend * backend)
+{
+	String const * push = damon_get_push(backend->damon);
+	size_t i;
+	DaMonHost * host;
+	uint64_t now;
+	int32_t res;
 
-#define DAMON_SEP		'/'
+	if(damon_clock(&now) != 0)
+		return;
+	for(i = 0; (host = damon_get_host_by_id(backend->damon, i)) != NULL;
+			i++)
+	{
+		if(host->appclient == NULL || !host->subscribed)
+			continue;
+		host->deadline = now + (uint64_t)damon_get_timeout(
+				backend->damon) * 1000;
+		if(_refresh_call(host, (void **)&res, "unsubscribe", push,
+					host->hostname) != 0)
+			error_set_print(PROGNAME_DAMON, 1, "%s: %s",
+					host->hostname, host->error);
+		host->error[0] = '\0';
+		_refresh_subscribed(host, false);
+	}
+}
 
 
+/* private */
+/* functions */
+/* backend_thread */
+static int _refresh_host(DaMonHost * host);
+
+static void * _backend_thread(void * data)
+{
+	DaMonBackend * backend = data;
+	DaMonHost * host;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&backend->mutex);
+		while(backend->queue_cnt == 0 && !backend->quit)
+			pthread_cond_wait(&backend->cond, &backend->mutex);
+		if(backend->quit)
+		{
+			pthread_mutex_unlock(&backend->mutex);
+			break;
+		}
+		host = backend->queue[backend->queue_pos];
+		backend->queue_pos = (backend->queue_pos + 1)
+			% backend->queue_size;
+		backend->queue_cnt--;
+		pthread_mutex_unlock(&backend->mutex);
+		host->error[0] = '\0';
+		host->status = _refresh_host(host);
+		/* hand the host back to the event loop, errors included */
+		if(write(backend->fds[1], &host, sizeof(host))
+				!= sizeof(host))
+			fputs(PROGNAME_DAMON ": Could not complete a poll\n",
+					stderr);
+	}
+	return NULL;
+}
+
+
+/* backend_on_done */
+static void _refresh_backoff(DaMonHost * host);
+static void _refresh_record(DaMonHost * host, Snapshot * snapshot,
+		SnapshotSummary * summary);
+static void _refresh_record_history(DaMonHost * host);
+static void _refresh_apply_names(DaMonHost * host);
+
+static int _backend_on_done(int fd, DaMonBackend * backend)
+{
+	DaMonHost * hosts[64];
+	ssize_t size;
+	size_t i;
+	DaMonHost * host;
+	(void) backend;
+
+	/* keep watching for the hosts done polling */
+	if((size = read(fd, hosts, sizeof(hosts))) <= 0)
+	{
+		if(size < 0 && errno != EINTR && errno != EAGAIN)
+			damon_perror("read", 1);
+		return 0;
+	}
+	for(i = 0; i < size / sizeof(*hosts); i++)
+	{
+		host = hosts[i];
+		/* the workers leave their errors to the event loop */
+		if(host->status < 0 && host->error[0] != '\0')
+			error_set_print(PROGNAME_DAMON, 1, "%s: %s",
+					host->hostname, host->error);
+		host->error[0] = '\0';
+		if(host->status < 0)
+			_refresh_backoff(host);
+		else
+		{
+			host->failures = 0;
+			_refresh_apply_names(host);
+			/* or the Probe pushed its snapshot instead */
+			if(host->backlog != NULL)
+				_refresh_record_history(host);
+			else if(host->status == 0)
+				_refresh_record(host, host->values,
+						host->summarized);
+		}
+		host->busy = false;
+	}
+	return 0;
+}
+
+
+/* DaMon */
+/* public */
 /* functions */
 /* damon_refresh */
-static AppClient * _refresh_connect(DaMonHost * host, Event * event);
-static int _refresh_uptime(AppClient * ac, DaMonHost * host, char * rrd);
-static int _refresh_load(AppClient * ac, DaMonHost * host, char * rrd);
-static int _refresh_ram(AppClient * ac, DaMonHost * host, char * rrd);
-static int _refresh_swap(AppClient * ac, DaMonHost * host, char * rrd);
-static int _refresh_procs(AppClient * ac, DaMonHost * host, char * rrd);
-static int _refresh_users(AppClient * ac, DaMonHost * host, char * rrd);
-static int _refresh_ifaces(AppClient * ac, DaMonHost * host, char * rrd);
-static int _refresh_ifaces_if(AppClient * ac, DaMonHost * host, char * rrd,
-		char const * iface);
-static int _refresh_vols(AppClient * ac, DaMonHost * host, char * rrd);
-static int _refresh_vols_vol(AppClient * ac, DaMonHost * host, char * rrd,
-		char * vol);
-
-int damon_refresh(DaMon * damon)
-{
-	size_t i;
-	AppClient * ac = NULL;
-	char * rrd = NULL;
-	char * p;
+static int _refresh_call(DaMonHost * host, void ** result,
+		char const * method, ...);
+static AppClient * _refresh_connect(DaMonHost * host);
+static int _refresh_downgrade(DaMonHost * host, bool * supported,
+		char const * what);
+static int _refresh_drop(DaMonHost * host);
+static int _refresh_error(DaMonHost * host, char const * format, ...);
+static String const * _refresh_resolve(DaMonHost * host);
+static int _refresh_fetch(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_delta(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_history(DaMonHost * host);
+static int _refresh_fetch_snapshot(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_summary(DaMonHost * host);
+static int _refresh_fetch_uptime(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_load(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_ram(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_swap(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_procs(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_users(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_discover(DaMonHost * host);
+static int _refresh_discover_names(DaMonHost * host, char const * method,
+		uint32_t * generation, Buffer ** listed);
+static int _refresh_fetch_ifaces(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_fetch_vols(DaMonHost * host, Snapshot * snapshot);
+static int _refresh_on_timeout(DaMonHost * host);
+static int _refresh_push(DaMonHost * host);
+static int _refresh_token(DaMonHost * host);
+static void _refresh_record_ifaces(DaMonHost * host, Snapshot * snapshot,
+		RRDSample * samples);
+static time_t _refresh_record_last(DaMonHost * host);
+static void _refresh_record_sample(RRDSample * sample,
+		uint64_t const * values, size_t values_cnt);
+static void _refresh_record_summary(SnapshotSummary * summary,
+		RRDSample * samples);
+static void _refresh_record_vols(DaMonHost * host, Snapshot * snapshot,
+		RRDSample * samples);
+
+int damon_refresh(DaMon * damon, DaMonHost ** hosts, size_t hosts_cnt)
+{
+	DaMonBackend * backend = damon_get_backend(damon);
+	uint64_t now;
+	size_t i;
 	DaMonHost * host;
 
+	if(damon_clock(&now) != 0)
+		return -1;
 #ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s()\n", __func__);
+	fprintf(stderr, "DEBUG: %s(%lu)\n", __func__,
+			(unsigned long)hosts_cnt);
 #endif
-	for(i = 0; (host = damon_get_host_by_id(damon, i)) != NULL; i++)
-	{
-		if((ac = host->appclient) == NULL)
-			if((ac = _refresh_connect(host, damon_get_event(damon)))
-					== NULL)
-				continue;
-		if((p = realloc(rrd, string_get_length(host->hostname) + 12))
-				== NULL) /* XXX avoid this constant */
+	pthread_mutex_lock(&backend->mutex);
+	for(i = 0; i < hosts_cnt; i++)
+	{
+		host = hosts[i];
+		/* the scheduler skips the hosts still polling */
+		if(host->busy)
+			continue;
+		/* do not insist with the hosts failing */
+		if(now < host->retry)
+			continue;
+		host->busy = true;
+		backend->queue[(backend->queue_pos + backend->queue_cnt++)
+			% backend->queue_size] = host;
+	}
+	pthread_cond_broadcast(&backend->cond);
+	pthread_mutex_unlock(&backend->mutex);
+	return 0;
+}
+
+
+/* private */
+/* functions */
+/* refresh_host */
+static int _refresh_host(DaMonHost * host)
+{
+	uint64_t now;
+	int res;
+
+	if(damon_clock(&now) != 0)
+		return _refresh_error(host, "%s", "Could not read the clock");
+	/* the whole poll has to fit within the refresh period */
+	host->deadline = now + (uint64_t)damon_get_refresh(host->damon) * 1000;
+	host->broken = false;
+	host->unsupported = false;
+	if(host->appclient == NULL && _refresh_connect(host) == NULL)
+		return -1;
+	if(host->values == NULL && (host->values = snapshot_new()) == NULL)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	if(host->discover && _refresh_discover(host) != 0
+			&& _refresh_downgrade(host, &host->discover,
+				"discovery") != 0)
+		return _refresh_drop(host);
+	if((res = _refresh_push(host)) > 0)
+		return 1;
+	if(res != 0 || _refresh_fetch(host, host->values) != 0)
+		return _refresh_drop(host);
+	return 0;
+}
+
+static void _apply_names_delete(char ** names);
+static char ** _apply_names_split(Buffer * buffer);
+
+static void _refresh_apply_names(DaMonHost * host)
+{
+	int ret;
+	char ** ifaces = NULL;
+	char ** vols = NULL;
+
+	if(host->ifaces_listed == NULL && host->vols_listed == NULL)
+		return;
+	/* the samples are only ever used from the event loop */
+	if(host->ifaces_listed != NULL
+			&& (ifaces = _apply_names_split(host->ifaces_listed))
+			== NULL)
+		ret = -1;
+	else if(host->vols_listed != NULL
+			&& (vols = _apply_names_split(host->vols_listed))
+			== NULL)
+	{
+		_apply_names_delete(ifaces);
+		ret = -1;
+	}
+	else
+		ret = damon_set_host_names(host->damon, host, ifaces, vols);
+	if(ret != 0)
+	{
+		damon_serror();
+		/* list them again on the next poll */
+		host->ifaces_generation = 0;
+		host->vols_generation = 0;
+	}
+	if(host->ifaces_listed != NULL)
+		buffer_delete(host->ifaces_listed);
+	host->ifaces_listed = NULL;
+	if(host->vols_listed != NULL)
+		buffer_delete(host->vols_listed);
+	host->vols_listed = NULL;
+}
+
+static void _apply_names_delete(char ** names)
+{
+	size_t i;
+
+	for(i = 0; names != NULL && names[i] != NULL; i++)
+		free(names[i]);
+	free(names);
+}
+
+static char ** _apply_names_split(Buffer * buffer)
+{
+	char const * data = buffer_get_data(buffer);
+	size_t size = buffer_get_size(buffer);
+	char ** names;
+	size_t cnt = 0;
+	size_t i;
+	size_t len;
+
+	/* every name is terminated by a NUL character */
+	for(i = 0; i < size; i++)
+		if(data[i] == '\0')
+			cnt++;
+	if((names = malloc(sizeof(*names) * (cnt + 1))) == NULL)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		return NULL;
+	}
+	for(i = 0, cnt = 0; i < size; i += len + 1)
+	{
+		if((len = strnlen(&data[i], size - i)) == size - i)
+			/* ignore what was left unterminated */
 			break;
-		rrd = p;
-		if(_refresh_uptime(ac, host, rrd) != 0
-				|| _refresh_load(ac, host, rrd) != 0
-				|| _refresh_ram(ac, host, rrd) != 0
-				|| _refresh_swap(ac, host, rrd) != 0
-				|| _refresh_procs(ac, host, rrd) != 0
-				|| _refresh_users(ac, host, rrd) != 0
-				|| _refresh_ifaces(ac, host, rrd) != 0
-				|| _refresh_vols(ac, host, rrd) != 0)
+		if((names[cnt] = strdup(&data[i])) == NULL)
 		{
-			appclient_delete(ac);
-			host->appclient = NULL;
-			continue;
+			error_set_code(-errno, "%s", strerror(errno));
+			_apply_names_delete(names);
+			return NULL;
 		}
-		ac = NULL;
+		cnt++;
 	}
-	free(rrd);
-	if(ac != NULL)
-		error_set_print(PROGNAME_DAMON, 1, "%s",
-				"refresh: An error occured");
-	return 0;
+	names[cnt] = NULL;
+	return names;
+}
+
+static void _refresh_backoff(DaMonHost * host)
+{
+	uint64_t now;
+	uint64_t delay;
+	unsigned int shift;
+
+	if(damon_clock(&now) != 0)
+		return;
+	/* wait twice as long after every failure, up to a limit */
+	shift = (host->failures < DAMON_BACKOFF_SHIFT_MAX) ? host->failures
+		: DAMON_BACKOFF_SHIFT_MAX;
+	host->failures++;
+	delay = ((uint64_t)damon_get_refresh(host->damon) * 1000) << shift;
+	/* so that the hosts do not all come back at once */
+	host->retry = now + delay / 2 + random() % (delay / 2 + 1);
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s: retrying in %lums\n", host->hostname,
+			(unsigned long)(host->retry - now));
+#endif
+}
+
+static bool _call_unknown(DaMonHost * host);
+static int _call_timed(DaMonHost * host, void ** result, char const * method,
+		...);
+static int _call_timedv(DaMonHost * host, void ** result,
+		char const * method, va_list ap);
+
+static int _refresh_call(DaMonHost * host, void ** result,
+		char const * method, ...)
+{
+	int ret;
+	va_list ap;
+
+	host->broken = false;
+	host->unsupported = false;
+	va_start(ap, method);
+	ret = _call_timedv(host, result, method, ap);
+	va_end(ap);
+	if(ret <= 0)
+		return ret;
+	/* only downgrade when the Probe does not know the call */
+	if(_call_unknown(host))
+		host->unsupported = true;
+	else
+		host->broken = true;
+	return _refresh_error(host, "%s: %s", method, "Call failed");
+}
+
+static bool _call_unknown(DaMonHost * host)
+{
+	int res;
+	uint32_t uptime;
+
+	/* still answering on this connection */
+	if((res = _call_timed(host, (void **)&uptime, "uptime")) == 0)
+		return true;
+	if(res < 0)
+		return false;
+	/* the Probe may close the connection on unknown calls */
+	appclient_delete(host->appclient);
+	host->appclient = NULL;
+	if(_refresh_connect(host) == NULL)
+		return false;
+	return (_call_timed(host, (void **)&uptime, "uptime") == 0)
+		? true : false;
+}
+
+static int _call_timed(DaMonHost * host, void ** result, char const * method,
+		...)
+{
+	int ret;
+	va_list ap;
+
+	va_start(ap, method);
+	ret = _call_timedv(host, result, method, ap);
+	va_end(ap);
+	return ret;
+}
+
+static int _call_timedv(DaMonHost * host, void ** result,
+		char const * method, va_list ap)
+{
+	int ret;
+	uint64_t now;
+	uint64_t timeout;
+	struct timeval tv;
+
+	/* -1 when the connection is not usable anymore, 1 if the call failed */
+	if(damon_clock(&now) != 0)
+	{
+		host->broken = true;
+		return _refresh_error(host, "%s", "Could not read the clock");
+	}
+	if(now >= host->deadline)
+	{
+		host->broken = true;
+		return _refresh_error(host, "%s: %s", method,
+				strerror(ETIMEDOUT));
+	}
+	timeout = (uint64_t)damon_get_timeout(host->damon) * 1000;
+	if(timeout > host->deadline - now)
+		timeout = host->deadline - now;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	host->expired = false;
+	if(event_register_timeout(host->event, &tv,
+				(EventTimeoutFunc)_refresh_on_timeout, host)
+			!= 0)
+	{
+		host->broken = true;
+		return _refresh_error(host, "%s: %s", method,
+				"Could not set the timeout");
+	}
+	ret = appclient_callv(host->appclient, result, method, ap);
+	if(host->expired)
+	{
+		host->broken = true;
+		return _refresh_error(host, "%s: %s", method,
+				strerror(ETIMEDOUT));
+	}
+	event_unregister_timeout(host->event,
+			(EventTimeoutFunc)_refresh_on_timeout);
+	return (ret != 0) ? 1 : 0;
 }
 
-static AppClient * _refresh_connect(DaMonHost * host, Event * event)
+static AppClient * _refresh_connect(DaMonHost * host)
 {
-	if(setenv("APPSERVER_Probe", host->hostname, 1) != 0)
+	String const * address;
+
+	if(host->event == NULL && (host->event = event_new()) == NULL)
+	{
+		_refresh_error(host, "%s", strerror(ENOMEM));
+		return NULL;
+	}
+	if((address = _refresh_resolve(host)) == NULL)
 		return NULL;
+	/* with an event loop of its own for the deadlines */
 	if((host->appclient = appclient_new_event(NULL, APPSERVER_PROBE_NAME,
-					NULL, event)) == NULL)
-		error_print(PROGNAME_DAMON);
+					address, host->event)) == NULL)
+	{
+		_refresh_error(host, "%s: %s", address, "Could not connect");
+		/* the host may have moved meanwhile */
+		string_delete(host->address);
+		host->address = NULL;
+	}
 	return host->appclient;
 }
 
-static int _refresh_uptime(AppClient * ac, DaMonHost * host, char * rrd)
+static int _refresh_downgrade(DaMonHost * host, bool * supported,
+		char const * what)
+{
+	/* timeouts and transport errors are not for downgrading */
+	if(host->broken)
+		return -1;
+	if(host->unsupported)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "DEBUG: %s: %s not supported\n",
+				host->hostname, what);
+#else
+		(void) what;
+#endif
+		*supported = false;
+		host->unsupported = false;
+	}
+	/* otherwise only fallback this time */
+	host->error[0] = '\0';
+	return 0;
+}
+
+static int _refresh_drop(DaMonHost * host)
+{
+	if(host->appclient != NULL)
+		appclient_delete(host->appclient);
+	host->appclient = NULL;
+	/* the Probe may have been upgraded meanwhile */
+	host->snapshot = true;
+	host->history = true;
+	host->delta = true;
+	host->seq = 0;
+	host->summary = true;
+	host->summary_seq = 0;
+	host->push = true;
+	_refresh_subscribed(host, false);
+	host->discover = true;
+	return -1;
+}
+
+static int _refresh_error(DaMonHost * host, char const * format, ...)
+{
+	va_list ap;
+
+	/* keep the first error, libSystem's own is not for threads */
+	if(host->error[0] != '\0')
+		return -1;
+	va_start(ap, format);
+	vsnprintf(host->error, sizeof(host->error), format, ap);
+	va_end(ap);
+	return -1;
+}
+
+static String const * _refresh_resolve(DaMonHost * host)
+{
+	uint64_t now;
+	char const * name = host->hostname;
+	char const * transport = "tcp";
+	int family = AF_UNSPEC;
+	String * h;
+	char * port;
+	struct addrinfo hints;
+	struct addrinfo * ai;
+	void const * addr;
+	char buf[INET6_ADDRSTRLEN];
+	int res;
+
+	if(damon_clock(&now) != 0)
+	{
+		_refresh_error(host, "%s", "Could not read the clock");
+		return NULL;
+	}
+	if(host->address != NULL && now < host->address_expiry)
+		return host->address;
+	string_delete(host->address);
+	host->address = NULL;
+	/* resolve [tcp:|tcp4:|tcp6:]host[:port], use anything else as is */
+	if(strncmp(name, "tcp:", 4) == 0)
+		name += 4;
+	else if(strncmp(name, "tcp4:", 5) == 0)
+	{
+		family = AF_INET;
+		name += 5;
+	}
+	else if(strncmp(name, "tcp6:", 5) == 0)
+	{
+		family = AF_INET6;
+		name += 5;
+	}
+	if((port = strchr(name, ':')) != NULL && (port[1] == '\0'
+				|| strspn(&port[1], "0123456789")
+				!= strlen(&port[1])))
+		transport = NULL;
+	if(transport == NULL)
+		host->address = string_new(host->hostname);
+	else
+	{
+		if((h = string_new(name)) == NULL)
+		{
+			_refresh_error(host, "%s", strerror(ENOMEM));
+			return NULL;
+		}
+		if((port = strchr(h, ':')) != NULL)
+			*(port++) = '\0';
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = family;
+		hints.ai_socktype = SOCK_STREAM;
+		if((res = getaddrinfo(h, NULL, &hints, &ai)) != 0)
+		{
+			_refresh_error(host, "%s", gai_strerror(res));
+			string_delete(h);
+			return NULL;
+		}
+		if(ai->ai_family == AF_INET6)
+		{
+			transport = "tcp6";
+			addr = &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr;
+		}
+		else
+		{
+			transport = "tcp4";
+			addr = &((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+		}
+		if(ai->ai_family == AF_INET6 && port == NULL)
+			/* the port would be mistaken within the address */
+			host->address = string_new_append(transport, ":", h,
+					NULL);
+		else if(inet_ntop(ai->ai_family, addr, buf, sizeof(buf))
+				!= NULL)
+			host->address = string_new_append(transport, ":", buf,
+					(port != NULL) ? ":" : NULL, port,
+					NULL);
+		else
+			_refresh_error(host, "%s", "Invalid address");
+		freeaddrinfo(ai);
+		string_delete(h);
+	}
+	if(host->address != NULL)
+		host->address_expiry = now + DAMON_RESOLVE_TTL * 1000;
+	else
+		_refresh_error(host, "%s", strerror(ENOMEM));
+	return host->address;
+}
+
+static int _refresh_discover(DaMonHost * host)
 {
-	int32_t ret;
+	if(host->ifaces_auto && _refresh_discover_names(host,
+				"list_interfaces", &host->ifaces_generation,
+				&host->ifaces_listed) != 0)
+		return -1;
+	if(host->vols_auto && _refresh_discover_names(host, "list_volumes",
+				&host->vols_generation, &host->vols_listed)
+			!= 0)
+		return -1;
+	return 0;
+}
+
+static int _refresh_discover_names(DaMonHost * host, char const * method,
+		uint32_t * generation, Buffer ** listed)
+{
+	int32_t res;
+	uint32_t g;
+	Buffer * buffer;
 
-	if(appclient_call(ac, (void **)&ret, "uptime") != 0)
-		return error_print(PROGNAME_DAMON);
-	sprintf(rrd, "%s%c%s", host->hostname, DAMON_SEP, "uptime.rrd");
-	damon_update(host->damon, RRDTYPE_UNKNOWN, rrd, 1, ret);
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	/* the Probe only lists them again after a change */
+	if(_refresh_call(host, (void **)&res, method, *generation, &g,
+				buffer) != 0 || res != 0)
+	{
+		buffer_delete(buffer);
+		return -1;
+	}
+	if(g == *generation)
+	{
+		buffer_delete(buffer);
+		return 0;
+	}
+	/* applied from the event loop */
+	if(*listed != NULL)
+		buffer_delete(*listed);
+	*listed = buffer;
+	*generation = g;
 	return 0;
 }
 
-static int _refresh_load(AppClient * ac, DaMonHost * host, char * rrd)
+static int _refresh_fetch(DaMonHost * host, Snapshot * snapshot)
 {
+	if(host->history)
+	{
+		if(_refresh_fetch_history(host) == 0)
+			return 0;
+		if(_refresh_downgrade(host, &host->history, "history") != 0)
+			return -1;
+	}
+	if(host->delta)
+	{
+		if(_refresh_fetch_delta(host, snapshot) == 0)
+			return _refresh_fetch_summary(host);
+		if(_refresh_downgrade(host, &host->delta, "deltas") != 0)
+			return -1;
+	}
+	/* the next delta has to start over */
+	host->seq = 0;
+	if(host->snapshot)
+	{
+		if(_refresh_fetch_snapshot(host, snapshot) == 0)
+			return _refresh_fetch_summary(host);
+		/* fallback to the individual calls */
+		if(_refresh_downgrade(host, &host->snapshot, "snapshot") != 0)
+			return -1;
+	}
+	if(_refresh_fetch_uptime(host, snapshot) != 0
+			|| _refresh_fetch_load(host, snapshot) != 0
+			|| _refresh_fetch_ram(host, snapshot) != 0
+			|| _refresh_fetch_swap(host, snapshot) != 0
+			|| _refresh_fetch_procs(host, snapshot) != 0
+			|| _refresh_fetch_users(host, snapshot) != 0
+			|| _refresh_fetch_ifaces(host, snapshot) != 0
+			|| _refresh_fetch_vols(host, snapshot) != 0)
+		return -1;
+	return 0;
+}
+
+static int _refresh_fetch_delta(DaMonHost * host, Snapshot * snapshot)
+{
+	int ret;
 	int32_t res;
-	uint32_t load[3];
+	uint32_t seq;
+	Buffer * buffer;
 
-	if(appclient_call(ac, (void **)&res, "load", &load[0], &load[1],
-				&load[2]) != 0)
-		return error_print(PROGNAME_DAMON);
-	if(res != 0)
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	/* applied over the last snapshot received */
+	if(_refresh_call(host, (void **)&res, "snapshot_delta", host->seq,
+				&seq, buffer) != 0 || res != 0)
+		ret = -1;
+	else if((ret = snapshot_decode(snapshot, buffer)) == 0)
+		host->seq = seq;
+	else
+		_refresh_error(host, "%s: %s", "snapshot_delta",
+				"Invalid snapshot");
+	buffer_delete(buffer);
+	return ret;
+}
+
+static int _refresh_fetch_history(DaMonHost * host)
+{
+	int32_t res;
+	uint32_t seq;
+	Buffer * buffer;
+
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	/* decoded and recorded from the event loop */
+	if(_refresh_call(host, (void **)&res, "history", host->seq, &seq,
+				buffer) != 0 || res != 0)
+	{
+		buffer_delete(buffer);
+		return -1;
+	}
+	host->backlog = buffer;
+	return 0;
+}
+
+static int _refresh_fetch_snapshot(DaMonHost * host, Snapshot * snapshot)
+{
+	int ret;
+	int32_t res;
+	Buffer * buffer;
+
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	if(_refresh_call(host, (void **)&res, "snapshot", buffer) != 0
+			|| res != 0)
+		ret = -1;
+	else if((ret = snapshot_decode(snapshot, buffer)) != 0)
+		_refresh_error(host, "%s: %s", "snapshot", "Invalid snapshot");
+	buffer_delete(buffer);
+	return ret;
+}
+
+static int _refresh_fetch_summary(DaMonHost * host)
+{
+	int ret = 0;
+	int32_t res;
+	uint32_t seq;
+	Buffer * buffer;
+
+	if(!host->summary)
 		return 0;
-	sprintf(rrd, "%s%c%s", host->hostname, DAMON_SEP, "load.rrd");
-	damon_update(host->damon, RRDTYPE_LOAD, rrd, 3,
-			load[0], load[1], load[2]);
+	if(host->summarized == NULL && (host->summarized = malloc(
+					sizeof(*host->summarized))) == NULL)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	snapshot_summary_reset(host->summarized);
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	/* for the values taken since the previous poll */
+	if(_refresh_call(host, (void **)&res, "summary", host->summary_seq,
+				&seq, buffer) != 0 || res != 0)
+		ret = _refresh_downgrade(host, &host->summary, "summary");
+	/* the first one would cover the whole history */
+	else if(host->summary_seq != 0 && snapshot_summary_decode(
+				host->summarized, buffer) != 0)
+	{
+		snapshot_summary_reset(host->summarized);
+		ret = _refresh_error(host, "%s: %s", "summary",
+				"Invalid summary");
+	}
+	else
+		host->summary_seq = seq;
+	buffer_delete(buffer);
+	return ret;
+}
+
+static int _refresh_fetch_uptime(DaMonHost * host, Snapshot * snapshot)
+{
+	uint32_t ret;
+
+	if(_refresh_call(host, (void **)&ret, "uptime") != 0)
+		return -1;
+	snapshot->uptime = ret;
 	return 0;
 }
 
-static int _refresh_procs(AppClient * ac, DaMonHost * host, char * rrd)
+static int _refresh_fetch_load(DaMonHost * host, Snapshot * snapshot)
 {
 	int32_t res;
+	uint32_t load[3];
+
+	if(_refresh_call(host, (void **)&res, "load", &load[0], &load[1],
+				&load[2]) != 0)
+		return -1;
+	snapshot->load[0] = load[0];
+	snapshot->load[1] = load[1];
+	snapshot->load[2] = load[2];
+	return 0;
+}
 
-	if(appclient_call(ac, (void **)&res, "procs") != 0)
+static int _refresh_fetch_procs(DaMonHost * host, Snapshot * snapshot)
+{
+	uint32_t res;
+
+	if(_refresh_call(host, (void **)&res, "procs") != 0)
 		return 1;
-	sprintf(rrd, "%s%c%s", host->hostname, DAMON_SEP, "procs.rrd");
-	damon_update(host->damon, RRDTYPE_UNKNOWN, rrd, 1, res);
+	snapshot->procs = res;
 	return 0;
 }
 
-static int _refresh_ram(AppClient * ac, DaMonHost * host, char * rrd)
+static int _refresh_fetch_ram(DaMonHost * host, Snapshot * snapshot)
 {
 	int32_t res;
 	uint32_t ram[4];
 
-	if(appclient_call(ac, (void **)&res, "ram", &ram[0], &ram[1], &ram[2],
+	if(_refresh_call(host, (void **)&res, "ram", &ram[0], &ram[1], &ram[2],
 				&ram[3]) != 0)
 		return 1;
-	sprintf(rrd, "%s%c%s", host->hostname, DAMON_SEP, "ram.rrd");
-	damon_update(host->damon, RRDTYPE_UNKNOWN, rrd, 4,
-			ram[0], ram[1], ram[2], ram[3]);
+	snapshot->ram[0] = ram[0];
+	snapshot->ram[1] = ram[1];
+	snapshot->ram[2] = ram[2];
+	snapshot->ram[3] = ram[3];
 	return 0;
 }
 
-static int _refresh_swap(AppClient * ac, DaMonHost * host, char * rrd)
+static int _refresh_fetch_swap(DaMonHost * host, Snapshot * snapshot)
 {
 	int32_t res;
 	uint32_t swap[2];
 
-	if(appclient_call(ac, (void **)&res, "swap", &swap[0], &swap[1]) != 0)
+	if(_refresh_call(host, (void **)&res, "swap", &swap[0], &swap[1]) != 0)
 		return 1;
-	sprintf(rrd, "%s%c%s", host->hostname, DAMON_SEP, "swap.rrd");
-	damon_update(host->damon, RRDTYPE_UNKNOWN, rrd, 2, swap[0], swap[1]);
+	snapshot->swap[0] = swap[0];
+	snapshot->swap[1] = swap[1];
 	return 0;
 }
 
-static int _refresh_users(AppClient * ac, DaMonHost * host, char * rrd)
+static int _refresh_fetch_users(DaMonHost * host, Snapshot * snapshot)
 {
-	int32_t res;
+	uint32_t res;
 
-	if(appclient_call(ac, (void **)&res, "users") != 0)
+	if(_refresh_call(host, (void **)&res, "users") != 0)
 		return 1;
-	sprintf(rrd, "%s%c%s", host->hostname, DAMON_SEP, "users.rrd");
-	damon_update(host->damon, RRDTYPE_USERS, rrd, 1, res);
+	snapshot->users = res;
 	return 0;
 }
 
-static int _refresh_ifaces(AppClient * ac, DaMonHost * host, char * rrd)
+static int _refresh_fetch_ifaces(DaMonHost * host, Snapshot * snapshot)
 {
-	char ** p = host->ifaces;
-	int ret = 0;
+	size_t cnt;
+	size_t i;
+	SnapshotInterface * iface;
+	uint32_t res[2];
 
-	if(p == NULL)
-		return 0;
-	for(; *p != NULL; p++)
-		ret |= _refresh_ifaces_if(ac, host, rrd, *p);
-	return ret;
+	for(cnt = 0; host->ifaces != NULL && host->ifaces[cnt] != NULL; cnt++);
+	if(snapshot_set_interfaces_count(snapshot, cnt) != 0)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	for(i = 0; i < cnt; i++)
+	{
+		iface = &snapshot->ifaces[i];
+		/* configured by hand, so possibly longer than supported */
+		if(snapshot_set_interface_name(snapshot, i, host->ifaces[i])
+				!= 0)
+			return _refresh_error(host, "%s: %s", host->ifaces[i],
+					strerror(ENAMETOOLONG));
+		if(_refresh_call(host, (void **)&res[0], "ifrxbytes",
+					host->ifaces[i]) != 0
+				|| _refresh_call(host, (void **)&res[1],
+					"iftxbytes", host->ifaces[i]) != 0)
+			return 1;
+		iface->rxbytes = res[0];
+		iface->txbytes = res[1];
+	}
+	return 0;
 }
 
-static int _refresh_ifaces_if(AppClient * ac, DaMonHost * host, char * rrd,
-		char const * iface)
+static int _refresh_fetch_vols(DaMonHost * host, Snapshot * snapshot)
 {
-	int32_t res[2];
+	size_t cnt;
+	size_t i;
+	SnapshotVolume * vol;
+	uint32_t res[2];
+
+	for(cnt = 0; host->vols != NULL && host->vols[cnt] != NULL; cnt++);
+	if(snapshot_set_volumes_count(snapshot, cnt) != 0)
+		return _refresh_error(host, "%s", strerror(ENOMEM));
+	for(i = 0; i < cnt; i++)
+	{
+		vol = &snapshot->vols[i];
+		if(snapshot_set_volume_name(snapshot, i, host->vols[i]) != 0)
+			return _refresh_error(host, "%s: %s", host->vols[i],
+					strerror(ENAMETOOLONG));
+		if(_refresh_call(host, (void **)&res[0], "voltotal",
+					host->vols[i]) != 0
+				|| _refresh_call(host, (void **)&res[1],
+					"volfree", host->vols[i]) != 0)
+			return 1;
+		vol->total = res[0];
+		vol->free = res[1];
+	}
+	return 0;
+}
+
+static int _refresh_on_timeout(DaMonHost * host)
+{
+	/* give up on the current call */
+	host->expired = true;
+	event_loop_quit(host->event);
+	return 1;
+}
+
+static int _refresh_push(DaMonHost * host)
+{
+	DaMonBackend * backend = damon_get_backend(host->damon);
+	String const * push;
+	uint64_t now;
+	uint64_t pushed;
+	bool subscribed;
+	int32_t res;
 
-	if(appclient_call(ac, (void **)&res[0], "ifrxbytes", iface) != 0
-			|| appclient_call(ac, (void **)&res[1], "iftxbytes",
-				iface) != 0)
+	if((push = damon_get_push(host->damon)) == NULL || !host->push
+			|| damon_clock(&now) != 0)
+		return 0;
+	pthread_mutex_lock(&backend->mutex);
+	pushed = host->pushed;
+	subscribed = host->subscribed;
+	/* accept the pushes already while subscribing */
+	host->subscribed = true;
+	pthread_mutex_unlock(&backend->mutex);
+	if(subscribed && now < pushed
+			+ (uint64_t)damon_get_refresh(host->damon) * 2000)
 		return 1;
-	sprintf(rrd, "%s%c%s%s", host->hostname, DAMON_SEP, iface, ".rrd");
-	damon_update(host->damon, RRDTYPE_UNKNOWN, rrd, 2, res[0], res[1]);
+	if(_refresh_token(host) != 0)
+	{
+		_refresh_subscribed(host, false);
+		return -1;
+	}
+	/* subscribe again, the Probe may have restarted meanwhile */
+	if(_refresh_call(host, (void **)&res, "subscribe", push,
+				host->hostname, host->token) != 0 || res != 0)
+	{
+		_refresh_subscribed(host, false);
+		/* the Probe does not push to us */
+		if(!host->broken)
+			host->unsupported = true;
+		return _refresh_downgrade(host, &host->push, "push");
+	}
+	pthread_mutex_lock(&backend->mutex);
+	host->pushed = now;
+	pthread_mutex_unlock(&backend->mutex);
+	/* poll this time still */
 	return 0;
 }
 
-static int _refresh_vols(AppClient * ac, DaMonHost * host, char * rrd)
+static void _refresh_subscribed(DaMonHost * host, bool subscribed)
 {
-	char ** p = host->vols;
-	int ret = 0;
+	DaMonBackend * backend = damon_get_backend(host->damon);
+
+	/* also read by DaMon_push() */
+	pthread_mutex_lock(&backend->mutex);
+	host->subscribed = subscribed;
+	pthread_mutex_unlock(&backend->mutex);
+}
 
-	if(p == NULL)
+static int _refresh_token(DaMonHost * host)
+{
+	DaMonBackend * backend = damon_get_backend(host->damon);
+	unsigned char buf[(sizeof(host->token) - 1) / 2];
+	char token[sizeof(host->token)];
+	int fd;
+	ssize_t size;
+	size_t i;
+
+	/* kept as long as DaMon runs */
+	if(host->token[0] != '\0')
 		return 0;
-	for(; *p != NULL; p++)
-		ret |= _refresh_vols_vol(ac, host, rrd, *p);
+	if((fd = open("/dev/urandom", O_RDONLY)) < 0)
+		return _refresh_error(host, "%s: %s", "/dev/urandom",
+				strerror(errno));
+	size = read(fd, buf, sizeof(buf));
+	close(fd);
+	if(size != sizeof(buf))
+		return _refresh_error(host, "%s: %s", "/dev/urandom",
+				(size < 0) ? strerror(errno) : strerror(EIO));
+	for(i = 0; i < sizeof(buf); i++)
+		snprintf(&token[i * 2], 3, "%02x", buf[i]);
+	pthread_mutex_lock(&backend->mutex);
+	memcpy(host->token, token, sizeof(token));
+	pthread_mutex_unlock(&backend->mutex);
+	return 0;
+}
+
+static void _refresh_record(DaMonHost * host, Snapshot * snapshot,
+		SnapshotSummary * summary)
+{
+	RRDSample * samples = host->samples;
+
+	_refresh_record_sample(&samples[DAMON_SAMPLE_UPTIME],
+			&snapshot->uptime, 1);
+	_refresh_record_sample(&samples[DAMON_SAMPLE_LOAD], snapshot->load, 3);
+	_refresh_record_sample(&samples[DAMON_SAMPLE_RAM], snapshot->ram, 4);
+	_refresh_record_sample(&samples[DAMON_SAMPLE_SWAP], snapshot->swap, 2);
+	_refresh_record_sample(&samples[DAMON_SAMPLE_PROCS], &snapshot->procs,
+			1);
+	_refresh_record_sample(&samples[DAMON_SAMPLE_USERS], &snapshot->users,
+			1);
+	_refresh_record_ifaces(host, snapshot,
+			&samples[DAMON_SAMPLE_COUNT]);
+	_refresh_record_vols(host, snapshot,
+			&samples[DAMON_SAMPLE_COUNT + host->ifaces_cnt]);
+	_refresh_record_summary(summary, &samples[host->samples_cnt
+			- DAMON_SAMPLE_COUNT * 2]);
+	damon_update(host->damon, samples, host->samples_cnt);
+	host->recorded = (samples[0].timestamp != 0) ? samples[0].timestamp
+		: time(NULL);
+}
+
+static void _refresh_record_history(DaMonHost * host)
+{
+	size_t offset = 0;
+	uint32_t seq;
+	time_t timestamp;
+	size_t i;
+
+	/* the databases refuse what is not newer than their last update */
+	if(host->recorded == 0)
+		host->recorded = _refresh_record_last(host);
+	/* every entry is applied over the previous one */
+	while(offset < buffer_get_size(host->backlog))
+	{
+		if(snapshot_history_decode(host->backlog, &offset, &seq,
+					&timestamp, host->values) != 0)
+		{
+			damon_serror();
+			/* start over */
+			host->seq = 0;
+			break;
+		}
+		host->seq = seq;
+		if(timestamp <= host->recorded)
+			continue;
+		for(i = 0; i < host->samples_cnt; i++)
+			host->samples[i].timestamp = timestamp;
+		_refresh_record(host, host->values, NULL);
+	}
+	for(i = 0; i < host->samples_cnt; i++)
+		host->samples[i].timestamp = 0;
+	buffer_delete(host->backlog);
+	host->backlog = NULL;
+}
+
+static void _refresh_record_ifaces(DaMonHost * host, Snapshot * snapshot,
+		RRDSample * samples)
+{
+	size_t i;
+	SnapshotInterface * iface;
+	uint64_t values[2];
+
+	for(i = 0; i < host->ifaces_cnt; i++)
+		if((iface = snapshot_get_interface(snapshot, host->ifaces[i]))
+				== NULL)
+			/* skip this interface */
+			samples[i].values_cnt = 0;
+		else
+		{
+			values[0] = iface->rxbytes;
+			values[1] = iface->txbytes;
+			_refresh_record_sample(&samples[i], values, 2);
+		}
+}
+
+static time_t _refresh_record_last(DaMonHost * host)
+{
+	time_t ret = 0;
+	size_t i;
+	struct stat st;
+
+	/* as left by the previous run, if any */
+	for(i = 0; i < host->samples_cnt; i++)
+		if(host->samples[i].filename != NULL
+				&& stat(host->samples[i].filename, &st) == 0
+				&& st.st_mtime > ret)
+			ret = st.st_mtime;
 	return ret;
 }
 
-static int _refresh_vols_vol(AppClient * ac, DaMonHost * host, char * rrd,
-		char * vol)
+static void _refresh_record_sample(RRDSample * sample,
+		uint64_t const * values, size_t values_cnt)
 {
-	int32_t res[2];
+	sample->values_cnt = values_cnt;
+	memcpy(sample->values, values, sizeof(*values) * values_cnt);
+}
 
-	if(appclient_call(ac, (void **)&res[0], "voltotal", vol) != 0
-			|| appclient_call(ac, (void **)&res[1], "volfree", vol)
-			!= 0)
-		return 1;
-	sprintf(rrd, "%s%s%s", host->hostname, vol, ".rrd"); /* FIXME */
-	damon_update(host->damon, RRDTYPE_VOLUME, rrd, 2, res[0], res[1]);
+static void _refresh_record_summary(SnapshotSummary * summary,
+		RRDSample * samples)
+{
+	/* values of every DaMonSample, in the order of the summary */
+	static const size_t counts[DAMON_SAMPLE_COUNT] = { 1, 3, 4, 2, 1, 1 };
+	size_t i;
+	size_t j;
+
+	for(i = 0, j = 0; i < DAMON_SAMPLE_COUNT; j += counts[i++])
+		if(summary == NULL || summary->count == 0)
+		{
+			samples[i].values_cnt = 0;
+			samples[DAMON_SAMPLE_COUNT + i].values_cnt = 0;
+		}
+		else
+		{
+			_refresh_record_sample(&samples[i], &summary->min[j],
+					counts[i]);
+			_refresh_record_sample(&samples[DAMON_SAMPLE_COUNT + i],
+					&summary->max[j], counts[i]);
+		}
+	/* recorded only once */
+	if(summary != NULL)
+		summary->count = 0;
+}
+
+static void _refresh_record_vols(DaMonHost * host, Snapshot * snapshot,
+		RRDSample * samples)
+{
+	size_t i;
+	SnapshotVolume * vol;
+	uint64_t values[2];
+
+	for(i = 0; i < host->vols_cnt; i++)
+		if((vol = snapshot_get_volume(snapshot, host->vols[i]))
+				== NULL)
+			/* skip this volume */
+			samples[i].values_cnt = 0;
+		else
+		{
+			values[0] = vol->total;
+			values[1] = vol->free;
+			_refresh_record_sample(&samples[i], values, 2);
+		}
+}
+
+
+/* AppInterface */
+/* DaMon_push */
+static bool _push_token(char const * token, char const * expected);
+
+int32_t DaMon_push(App * app, AppServerClient * asc, String const * name,
+		String const * token, Buffer * buffer)
+{
+	DaMonBackend * backend = app->backend;
+	size_t i;
+	DaMonHost * host;
+	bool subscribed;
+	uint64_t now;
+	Snapshot * snapshot;
+	(void) asc;
+
+	for(i = 0; (host = damon_get_host_by_id(backend->damon, i)) != NULL;
+			i++)
+		if(strcmp(host->hostname, name) == 0)
+			break;
+	if(host == NULL)
+		return -1;
+	/* only from the Probes subscribed to, as told when subscribing */
+	pthread_mutex_lock(&backend->mutex);
+	subscribed = host->subscribed && _push_token(token, host->token);
+	pthread_mutex_unlock(&backend->mutex);
+	if(!subscribed || damon_clock(&now) != 0
+			|| (snapshot = snapshot_new()) == NULL)
+		return -1;
+	if(snapshot_decode(snapshot, buffer) != 0)
+	{
+		snapshot_delete(snapshot);
+		return -1;
+	}
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, name);
+#endif
+	_refresh_record(host, snapshot, NULL);
+	snapshot_delete(snapshot);
+	pthread_mutex_lock(&backend->mutex);
+	host->pushed = now;
+	pthread_mutex_unlock(&backend->mutex);
 	return 0;
 }
+
+static bool _push_token(char const * token, char const * expected)
+{
+	unsigned char diff = 0;
+	size_t i;
+
+	if(expected[0] == '\0' || strlen(token) != strlen(expected))
+		return false;
+	/* in constant time */
+	for(i = 0; expected[i] != '\0'; i++)
+		diff |= token[i] ^ expected[i];
+	return diff == 0;
+}
@@ -29,6 +29,39 @@
 #endif
 
 
+/* DaMonBackend */
+/* private */
+/* types */
+struct _DaMonBackend
+{
+	DaMon * damon;
+	uint64_t next;				/* monotonic, in milliseconds */
+};
+
+
+/* public */
+/* functions */
+/* damon_backend_new */
+DaMonBackend * damon_backend_new(DaMon * damon)
+{
+	DaMonBackend * backend;
+
+	if((backend = object_new(sizeof(*backend))) == NULL)
+		return NULL;
+	backend->damon = damon;
+	backend->next = 0;
+	return backend;
+}
+
+
+/* damon_backend_delete */
+void damon_backend_delete(DaMonBackend * backend)
+{
+	object_delete(backend);
+}
+
+
+/* DaMon */
 /* damon_refresh */
 typedef enum _SaltFunction
 {
@@ -57,9 +90,22 @@ static int _refresh_parse_hostname_w(DaMon * damon, char const * hostname,
 static int _refresh_parse_pkg_list_upgrades(DaMon * damon, json_t * json);
 static int _refresh_parse_status_all_status(DaMon * damon, json_t * json);
 static int _refresh_parse_status_procs(DaMon * damon, json_t * json);
+static int _refresh_update(DaMon * damon, RRDType type, char const * rrd,
+		uint64_t const * values, size_t values_cnt);
 
-int damon_refresh(DaMon * damon)
+int damon_refresh(DaMon * damon, DaMonHost ** hosts, size_t hosts_cnt)
 {
+	DaMonBackend * backend = damon_get_backend(damon);
+	uint64_t now;
+	(void) hosts;
+	(void) hosts_cnt;
+
+	/* Salt polls every host at once, so only once per period */
+	if(damon_clock(&now) != 0)
+		return -1;
+	if(now < backend->next)
+		return 0;
+	backend->next = now + (uint64_t)damon_get_refresh(damon) * 1000;
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
@@ -162,12 +208,13 @@ static int _refresh_parse_hostname_diskusage_volume(DaMon * damon,
 		return -1;
 	/* graph the volume used instead */
 	usage[0] = usage[1] - usage[0];
-	if((rrd = string_new_append(hostname, "/volume",
+	if((rrd = string_new_append(damon_get_prefix(damon), "/",
+					hostname, "/volume",
 					(strcmp(volume, "/") == 0)
 					? "" : volume,
 					".rrd", NULL)) == NULL)
 		return -1;
-	ret = damon_update(damon, RRDTYPE_VOLUME, rrd, 2, usage[0], usage[1]);
+	ret = _refresh_update(damon, RRDTYPE_VOLUME, rrd, usage, 2);
 	string_delete(rrd);
 	return ret;
 }
@@ -194,10 +241,10 @@ static int _refresh_parse_hostname_loadavg(DaMon * damon, char const * hostname,
 			load[1] = json_real_value(value) * 1000;
 		else if(strcmp(key, "15-min") == 0)
 			load[2] = json_real_value(value) * 1000;
-	if((rrd = string_new_append(hostname, "/load.rrd", NULL)) == NULL)
+	if((rrd = string_new_append(damon_get_prefix(damon), "/",
+					hostname, "/load.rrd", NULL)) == NULL)
 		return -1;
-	ret = damon_update(damon, RRDTYPE_LOAD, rrd,
-			3, load[0], load[1], load[2]);
+	ret = _refresh_update(damon, RRDTYPE_LOAD, rrd, load, 3);
 	string_delete(rrd);
 	return ret;
 }
@@ -219,9 +266,10 @@ static int _refresh_parse_hostname_pkg_list_upgrades(DaMon * damon,
 		return -1;
 	json_object_foreach(json, key, value)
 		count++;
-	if((rrd = string_new_append(hostname, "/upgrades.rrd", NULL)) == NULL)
+	if((rrd = string_new_append(damon_get_prefix(damon), "/",
+					hostname, "/upgrades.rrd", NULL)) == NULL)
 		return -1;
-	ret = damon_update(damon, RRDTYPE_UPGRADES, rrd, 1, count);
+	ret = _refresh_update(damon, RRDTYPE_UPGRADES, rrd, &count, 1);
 	string_delete(rrd);
 	return ret;
 }
@@ -243,9 +291,10 @@ static int _refresh_parse_hostname_procs(DaMon * damon, char const * hostname,
 		return -1;
 	json_object_foreach(json, key, value)
 		count++;
-	if((rrd = string_new_append(hostname, "/procs.rrd", NULL)) == NULL)
+	if((rrd = string_new_append(damon_get_prefix(damon), "/",
+					hostname, "/procs.rrd", NULL)) == NULL)
 		return -1;
-	ret = damon_update(damon, RRDTYPE_PROCS, rrd, 1, count);
+	ret = _refresh_update(damon, RRDTYPE_PROCS, rrd, &count, 1);
 	string_delete(rrd);
 	return ret;
 }
@@ -267,9 +316,10 @@ static int _refresh_parse_hostname_w(DaMon * damon, char const * hostname,
 		return -1;
 	json_array_foreach(json, index, value)
 		count++;
-	if((rrd = string_new_append(hostname, "/users.rrd", NULL)) == NULL)
+	if((rrd = string_new_append(damon_get_prefix(damon), "/",
+					hostname, "/users.rrd", NULL)) == NULL)
 		return -1;
-	ret = damon_update(damon, RRDTYPE_USERS, rrd, 1, count);
+	ret = _refresh_update(damon, RRDTYPE_USERS, rrd, &count, 1);
 	string_delete(rrd);
 	return ret;
 }
@@ -357,3 +407,16 @@ static int _refresh_parse_status_procs(DaMon * damon, json_t * json)
 	}
 	return 0;
 }
+
+static int _refresh_update(DaMon * damon, RRDType type, char const * rrd,
+		uint64_t const * values, size_t values_cnt)
+{
+	RRDSample sample;
+
+	sample.timestamp = 0;
+	sample.type = type;
+	sample.filename = rrd;
+	sample.values_cnt = values_cnt;
+	memcpy(sample.values, values, sizeof(*values) * values_cnt);
+	return damon_update(damon, &sample, 1);
+}
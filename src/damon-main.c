@@ -16,7 +16,11 @@
 
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include "damon.h"
 #include "../config.h"
 
@@ -30,24 +34,77 @@
 /* private */
 /* prototypes */
 static int _damon(char const * config);
+static void _damon_on_signal(int signum);
+static int _damon_on_signaled(int fd, Event * event);
 
 static int _damon_usage(void);
 
 
 /* public */
+/* variables */
+/* the signals are only noted there, for the event loop to quit */
+static int _damon_signal[2] = { -1, -1 };
+
+
 /* functions */
 /* damon */
 static int _damon(char const * config)
 {
+	int ret = 0;
 	DaMon * damon;
 	Event * event;
+	struct sigaction sa;
 
 	if((damon = damon_new(config)) == NULL)
 		return 1;
 	event = damon_get_event(damon);
+	/* quit cleanly so that pending samples are written */
+	if(pipe(_damon_signal) != 0)
+		damon_perror("pipe", 1);
+	else
+	{
+		fcntl(_damon_signal[1], F_SETFL, O_NONBLOCK);
+		event_register_io_read(event, _damon_signal[0],
+				(EventIOFunc)_damon_on_signaled, event);
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = _damon_on_signal;
+		sigemptyset(&sa.sa_mask);
+		if(sigaction(SIGINT, &sa, NULL) != 0
+				|| sigaction(SIGTERM, &sa, NULL) != 0)
+			damon_perror("sigaction", 1);
+	}
 	if(event_loop(event) != 0)
+	{
 		error_print(PROGNAME_DAMON);
+		ret = 1;
+	}
 	damon_delete(damon);
+	return ret;
+}
+
+
+/* damon_on_signal */
+static void _damon_on_signal(int signum)
+{
+	int e = errno;
+	char c = signum;
+	ssize_t res;
+
+	/* only what is safe from a signal handler */
+	res = write(_damon_signal[1], &c, sizeof(c));
+	(void) res;
+	errno = e;
+}
+
+
+/* damon_on_signaled */
+static int _damon_on_signaled(int fd, Event * event)
+{
+	char buf[16];
+
+	if(read(fd, buf, sizeof(buf)) < 0 && errno == EINTR)
+		return 0;
+	event_loop_quit(event);
 	return 1;
 }
 
@@ -20,12 +20,17 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <System.h>
 #include <System/App.h>
 #include "damon.h"
+#include "store.h"
+#include "table.h"
+#include "writer.h"
 #include "../config.h"
 
 /* constants */
@@ -46,22 +51,56 @@
 struct _DaMon
 {
 	String * prefix;
-	String * rrdcached;
+	RRD * rrd;
+	Store * store;
 	unsigned int refresh;
+	unsigned int timeout;
+	String * listen;
+	String * push;
+
+	/* writer threads */
+	Writer ** writers;
+	unsigned int writers_cnt;
+	unsigned long dropped;
+	Table * names;				/* interned for the writers */
+
+	unsigned int concurrency;
 	DaMonHost * hosts;
 	unsigned int hosts_cnt;
+
+	/* scheduler */
+	uint64_t next;				/* without any host */
+	unsigned long overruns;
+	DaMonHost ** due;
+
 	Event * event;
 	bool event_delete;
+	DaMonBackend * backend;
 };
 
 
 /* constants */
-#define DAMON_DEFAULT_REFRESH	60
+#define DAMON_DEFAULT_CONCURRENCY	16
+#define DAMON_DEFAULT_COPROCESSES	2
+#define DAMON_DEFAULT_QUEUE		4096
+#define DAMON_DEFAULT_REFRESH		60
+#define DAMON_DEFAULT_TIMEOUT		10
+#define DAMON_DEFAULT_STORE_CHUNK	7200
+#define DAMON_DEFAULT_STORE_RETENTION	30
+#define DAMON_SCHEDULE_TICK_MIN		100
+#define DAMON_SCHEDULE_TICK_MAX		1000
 
 
 /* prototypes */
 static int _damon_init(DaMon * damon, char const * config, Event * event);
 static void _damon_destroy(DaMon * damon);
+static void _destroy_host(DaMonHost * host);
+static void _destroy_host_names(char ** names);
+static void _destroy_host_samples(RRDSample * samples, size_t samples_cnt);
+
+static int _damon_on_schedule(DaMon * damon);
+static String const * _damon_intern(DaMon * damon, char const * string,
+		size_t * hash);
 
 
 /* functions */
@@ -110,6 +149,20 @@ void damon_delete(DaMon * damon)
 
 
 /* accessors */
+/* damon_get_backend */
+DaMonBackend * damon_get_backend(DaMon * damon)
+{
+	return damon->backend;
+}
+
+
+/* damon_get_concurrency */
+unsigned int damon_get_concurrency(DaMon * damon)
+{
+	return damon->concurrency;
+}
+
+
 /* damon_get_event */
 Event * damon_get_event(DaMon * damon)
 {
@@ -119,13 +172,97 @@ Event * damon_get_event(DaMon * damon)
 /* damon_get_host_by_id */
 DaMonHost * damon_get_host_by_id(DaMon * damon, size_t id)
 {
-	if(damon->hosts_cnt >= id)
+	if(id >= damon->hosts_cnt)
 		return NULL;
 	return &damon->hosts[id];
 }
 
+/* damon_get_listen */
+String const * damon_get_listen(DaMon * damon)
+{
+	return damon->listen;
+}
+
+
+/* damon_get_prefix */
+String const * damon_get_prefix(DaMon * damon)
+{
+	return damon->prefix;
+}
+
+
+/* damon_get_push */
+String const * damon_get_push(DaMon * damon)
+{
+	return damon->push;
+}
+
+
+/* damon_get_refresh */
+unsigned int damon_get_refresh(DaMon * damon)
+{
+	return damon->refresh;
+}
+
+
+/* damon_get_timeout */
+unsigned int damon_get_timeout(DaMon * damon)
+{
+	return damon->timeout;
+}
+
+
+/* damon_set_host_names */
+static int _init_config_hosts_host_samples(DaMon * damon, DaMonHost * host);
+
+int damon_set_host_names(DaMon * damon, DaMonHost * host, char ** ifaces,
+		char ** vols)
+{
+	DaMonHost previous = *host;
+
+	/* the names are taken over, NULL keeps the current ones */
+	if(ifaces != NULL)
+		host->ifaces = ifaces;
+	if(vols != NULL)
+		host->vols = vols;
+	host->ifaces_cnt = 0;
+	host->vols_cnt = 0;
+	host->samples = NULL;
+	host->samples_cnt = 0;
+	if(_init_config_hosts_host_samples(damon, host) != 0)
+	{
+		/* keep recording as before */
+		_destroy_host_samples(host->samples, host->samples_cnt);
+		if(ifaces != NULL)
+			_destroy_host_names(ifaces);
+		if(vols != NULL)
+			_destroy_host_names(vols);
+		*host = previous;
+		return -1;
+	}
+	_destroy_host_samples(previous.samples, previous.samples_cnt);
+	if(ifaces != NULL)
+		_destroy_host_names(previous.ifaces);
+	if(vols != NULL)
+		_destroy_host_names(previous.vols);
+	return 0;
+}
+
 
 /* useful */
+/* damon_clock */
+int damon_clock(uint64_t * now)
+{
+	struct timespec ts;
+
+	/* in milliseconds, regardless of changes to the time of day */
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return damon_perror("clock_gettime", -errno);
+	*now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	return 0;
+}
+
+
 /* damon_error */
 int damon_error(char const * message, int ret)
 {
@@ -150,26 +287,93 @@ int damon_serror(void)
 
 
 /* damon_update */
-int damon_update(DaMon * damon, RRDType type, char const * filename,
-		int args_cnt, ...)
+static int _update_writers(DaMon * damon, RRDSample const * samples,
+		size_t samples_cnt);
+
+int damon_update(DaMon * damon, RRDSample const * samples, size_t samples_cnt)
 {
 	int ret;
-	char * path;
-	va_list args;
+	size_t len;
+	time_t now;
+	size_t i;
+	char const * name;
 
-#ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s(%u, \"%s\", %d, ...) \"%s\"\n", __func__,
-			type, filename, args_cnt, damon->prefix);
-#endif
-	if((path = string_new_append(damon->prefix, "/", filename, NULL))
-			== NULL)
-		return -1;
-	va_start(args, args_cnt);
-	ret = rrd_updatev(type, damon->rrdcached, path, args_cnt, args);
-	va_end(args);
-	string_delete(path);
-	if(ret != 0)
+	if(damon->writers_cnt > 0)
+		return _update_writers(damon, samples, samples_cnt);
+	if((ret = damon_rrd_update(damon->rrd, samples, samples_cnt)) != 0)
 		damon_serror();
+	if(damon->store == NULL)
+		return ret;
+	/* keep the raw samples as well */
+	len = string_get_length(damon->prefix);
+	now = time(NULL);
+	for(i = 0; i < samples_cnt; i++)
+	{
+		if(samples[i].values_cnt == 0)
+			continue;
+		name = samples[i].filename;
+		if(strncmp(name, damon->prefix, len) == 0 && name[len] == '/')
+			name += len + 1;
+		if(store_append(damon->store, name, (samples[i].timestamp != 0)
+					? samples[i].timestamp : now,
+					samples[i].values,
+					samples[i].values_cnt) != 0)
+		{
+			damon_serror();
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+static int _update_writers(DaMon * damon, RRDSample const * samples,
+		size_t samples_cnt)
+{
+	int ret = 0;
+	size_t len;
+	time_t now;
+	size_t i;
+	RRDSample sample;
+	size_t hash;
+	char const * name;
+	unsigned long dropped = 0;
+
+	len = string_get_length(damon->prefix);
+	now = time(NULL);
+	for(i = 0; i < samples_cnt; i++)
+	{
+		if(samples[i].values_cnt == 0)
+			continue;
+		sample = samples[i];
+		/* the samples are written after the caller is done with them */
+		if((sample.filename = _damon_intern(damon, samples[i].filename,
+						&hash)) == NULL)
+		{
+			damon_serror();
+			ret = -1;
+			continue;
+		}
+		if(sample.timestamp == 0)
+			sample.timestamp = now;
+		name = sample.filename;
+		if(strncmp(name, damon->prefix, len) == 0 && name[len] == '/')
+			name += len + 1;
+		/* always write a given database from the same thread */
+		if(writer_push(damon->writers[hash % damon->writers_cnt],
+					&sample, name) != 0)
+		{
+			damon_serror();
+			ret = -1;
+		}
+	}
+	for(i = 0; i < damon->writers_cnt; i++)
+		dropped += writer_get_dropped(damon->writers[i]);
+	if(dropped > damon->dropped)
+	{
+		error_set_print(PROGNAME_DAMON, 0, "%lu %s",
+				dropped - damon->dropped, "sample(s) dropped");
+		damon->dropped = dropped;
+	}
 	return ret;
 }
 
@@ -178,25 +382,69 @@ int damon_update(DaMon * damon, RRDType type, char const * filename,
 /* functions */
 /* damon_init */
 static int _init_config(DaMon * damon, char const * filename);
+static int _init_config_storage(DaMon * damon, Config * config,
+		unsigned int coprocesses);
+static RRD * _init_config_rrd(DaMon * damon, Config * config,
+		unsigned int coprocesses, Event * event, unsigned int * delay);
+static unsigned int _init_config_buffering(DaMon * damon, Config * config,
+		RRD * rrd);
+static Store * _init_config_store(Config * config);
 static int _init_config_hosts(DaMon * damon, Config * config,
 		String const * hosts);
 static int _init_config_hosts_host(DaMon * damon, Config * config, DaMonHost * host,
 		String const * h, unsigned int pos);
 static char ** _init_config_hosts_host_comma(char const * line);
+static int _init_config_hosts_host_samples(DaMon * damon, DaMonHost * host);
+static int _init_schedule(DaMon * damon, struct timeval * tv);
 
 static int _damon_init(DaMon * damon, char const * config, Event * event)
 {
 	struct timeval tv;
 
-	if(_init_config(damon, config) != 0)
-		return 1;
 	damon->event = event;
 	damon->event_delete = false;
-	damon_refresh(damon);
-	tv.tv_sec = damon->refresh;
-	tv.tv_usec = 0;
+	if(_init_config(damon, config) != 0)
+		return 1;
+	if((damon->backend = damon_backend_new(damon)) == NULL
+			|| _init_schedule(damon, &tv) != 0)
+	{
+		_damon_destroy(damon);
+		return 1;
+	}
 	event_register_timeout(damon->event, &tv,
-			(EventTimeoutFunc)damon_refresh, damon);
+			(EventTimeoutFunc)_damon_on_schedule, damon);
+	return 0;
+}
+
+static int _init_schedule(DaMon * damon, struct timeval * tv)
+{
+	uint64_t now;
+	uint64_t period = (uint64_t)damon->refresh * 1000;
+	uint64_t tick;
+	unsigned int i;
+	DaMonHost * host;
+
+	if(damon_clock(&now) != 0)
+		return -1;
+	if(damon->hosts_cnt > 0 && (damon->due = malloc(sizeof(*damon->due)
+					* damon->hosts_cnt)) == NULL)
+		return damon_perror(NULL, -errno);
+	/* spread the hosts over the period, always in the same order */
+	damon->next = now;
+	for(i = 0; i < damon->hosts_cnt; i++)
+	{
+		host = &damon->hosts[i];
+		host->next = now + table_hash(host->hostname) % period;
+		host->overruns = 0;
+	}
+	/* check often enough to honour every slot */
+	tick = (damon->hosts_cnt > 0) ? period / damon->hosts_cnt : period;
+	if(tick < DAMON_SCHEDULE_TICK_MIN)
+		tick = DAMON_SCHEDULE_TICK_MIN;
+	else if(tick > DAMON_SCHEDULE_TICK_MAX)
+		tick = DAMON_SCHEDULE_TICK_MAX;
+	tv->tv_sec = tick / 1000;
+	tv->tv_usec = (tick % 1000) * 1000;
 	return 0;
 }
 
@@ -206,14 +454,27 @@ static int _init_config(DaMon * damon, char const * filename)
 	String const * p;
 	char * q;
 	int tmp;
+	unsigned int coprocesses;
 
 	if((config = config_new()) == NULL)
 		return 1;
 	damon->prefix = NULL;
-	damon->rrdcached = NULL;
+	damon->rrd = NULL;
+	damon->store = NULL;
+	damon->writers = NULL;
+	damon->writers_cnt = 0;
+	damon->dropped = 0;
+	damon->names = NULL;
 	damon->refresh = DAMON_DEFAULT_REFRESH;
+	damon->timeout = DAMON_DEFAULT_TIMEOUT;
+	damon->listen = NULL;
+	damon->push = NULL;
+	damon->concurrency = DAMON_DEFAULT_CONCURRENCY;
 	damon->hosts = NULL;
 	damon->hosts_cnt = 0;
+	damon->next = 0;
+	damon->overruns = 0;
+	damon->due = NULL;
 	if(filename == NULL)
 		filename = SYSCONFDIR "/" PROGNAME_DAMON ".conf";
 	if(config_load(config, filename) != 0)
@@ -229,12 +490,12 @@ static int _init_config(DaMon * damon, char const * filename)
 		config_delete(config);
 		return -1;
 	}
-	if((p = config_get(config, NULL, "rrdcached")) != NULL
-			&& (damon->rrdcached = string_new(p)) == NULL)
+	coprocesses = DAMON_DEFAULT_COPROCESSES;
+	if((p = config_get(config, NULL, "coprocesses")) != NULL)
 	{
-		string_delete(damon->prefix);
-		config_delete(config);
-		return -1;
+		tmp = strtol(p, &q, 10);
+		coprocesses = (*p == '\0' || *q != '\0' || tmp < 0)
+			? DAMON_DEFAULT_COPROCESSES : tmp;
 	}
 	if((p = config_get(config, NULL, "refresh")) != NULL)
 	{
@@ -246,12 +507,206 @@ static int _init_config(DaMon * damon, char const * filename)
 				damon->refresh);
 #endif
 	}
+	if((p = config_get(config, NULL, "timeout")) != NULL)
+	{
+		tmp = strtol(p, &q, 10);
+		damon->timeout = (*p == '\0' || *q != '\0' || tmp <= 0)
+			? DAMON_DEFAULT_TIMEOUT : tmp;
+	}
+	if((p = config_get(config, NULL, "concurrency")) != NULL)
+	{
+		tmp = strtol(p, &q, 10);
+		damon->concurrency = (*p == '\0' || *q != '\0' || tmp <= 0)
+			? DAMON_DEFAULT_CONCURRENCY : tmp;
+#ifdef DEBUG
+		fprintf(stderr, "DEBUG: %s() concurrency=%u\n", __func__,
+				damon->concurrency);
+#endif
+	}
+	/* let the Probes push their snapshots */
+	if((p = config_get(config, NULL, "push")) != NULL)
+		damon->push = string_new(p);
+	if((p = config_get(config, NULL, "listen")) != NULL)
+		damon->listen = string_new(p);
+	if(_init_config_storage(damon, config, coprocesses) != 0)
+	{
+		string_delete(damon->listen);
+		string_delete(damon->push);
+		string_delete(damon->prefix);
+		config_delete(config);
+		return -1;
+	}
 	if((p = config_get(config, NULL, "hosts")) != NULL)
 		_init_config_hosts(damon, config, p);
 	config_delete(config);
 	return 0;
 }
 
+static int _init_config_storage(DaMon * damon, Config * config,
+		unsigned int coprocesses)
+{
+	String const * p;
+	char * q;
+	int tmp;
+	unsigned int writers = 0;
+	size_t queue = DAMON_DEFAULT_QUEUE;
+	WriterPolicy policy = WRITERPOLICY_BLOCK;
+	unsigned int delay;
+	RRD * rrd;
+	Store * store;
+
+	if((p = config_get(config, NULL, "writers")) != NULL)
+	{
+		tmp = strtol(p, &q, 10);
+		writers = (*p == '\0' || *q != '\0' || tmp < 0) ? 0 : tmp;
+	}
+	if(writers > 0 && config_get(config, NULL, "rrdcached") != NULL)
+	{
+		/* rrdcached is asynchronous already */
+		error_set_print(PROGNAME_DAMON, 0, "%s",
+				"rrdcached: Not using the writers");
+		writers = 0;
+	}
+	if(writers == 0)
+	{
+		/* write from the event loop */
+		if((damon->rrd = _init_config_rrd(damon, config, coprocesses,
+						damon->event, &delay)) == NULL)
+			return -1;
+		damon->store = _init_config_store(config);
+		return 0;
+	}
+	if((p = config_get(config, NULL, "queue")) != NULL)
+	{
+		tmp = strtol(p, &q, 10);
+		if(*p != '\0' && *q == '\0' && tmp > 0)
+			queue = tmp;
+	}
+	if((p = config_get(config, NULL, "queue_policy")) != NULL)
+	{
+		if(strcmp(p, "drop") == 0)
+			policy = WRITERPOLICY_DROP;
+		else if(strcmp(p, "block") != 0)
+			error_set_print(PROGNAME_DAMON, 1, "%s: %s", p,
+					"Unknown queue policy");
+	}
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() writers=%u queue=%zu\n", __func__,
+			writers, queue);
+#endif
+	if((damon->writers = malloc(sizeof(*damon->writers) * writers))
+			== NULL)
+		return damon_perror(NULL, -errno);
+	for(; damon->writers_cnt < writers; damon->writers_cnt++)
+	{
+		/* with a process of their own each */
+		if((rrd = _init_config_rrd(damon, config,
+						(coprocesses > 0) ? 1 : 0, NULL,
+						&delay)) == NULL)
+			break;
+		store = _init_config_store(config);
+		if((damon->writers[damon->writers_cnt] = writer_new(rrd, store,
+						queue, policy, delay)) == NULL)
+		{
+			if(store != NULL)
+				store_delete(store);
+			damon_rrd_delete(rrd);
+			break;
+		}
+	}
+	if(damon->writers_cnt == writers)
+		return 0;
+	damon_serror();
+	while(damon->writers_cnt > 0)
+		writer_delete(damon->writers[--damon->writers_cnt]);
+	free(damon->writers);
+	damon->writers = NULL;
+	return -1;
+}
+
+static RRD * _init_config_rrd(DaMon * damon, Config * config,
+		unsigned int coprocesses, Event * event, unsigned int * delay)
+{
+	RRD * rrd;
+	String const * p;
+
+	if((rrd = damon_rrd_new(config_get(config, NULL, "rrdtool"),
+					config_get(config, NULL, "rrdcached"),
+					coprocesses, event)) == NULL)
+		return NULL;
+	if((p = config_get(config, NULL, "engine")) != NULL
+			&& strcmp(p, "rrdtool") != 0)
+	{
+		if(strcmp(p, "native") == 0)
+			damon_rrd_set_engine(rrd, RRDENGINE_NATIVE);
+		else
+			error_set_print(PROGNAME_DAMON, 1, "%s: %s", p,
+					"Unknown storage engine");
+	}
+	*delay = _init_config_buffering(damon, config, rrd);
+	return rrd;
+}
+
+static unsigned int _init_config_buffering(DaMon * damon, Config * config,
+		RRD * rrd)
+{
+	String const * p;
+	char * q;
+	int tmp;
+	unsigned int samples = 1;
+	unsigned int delay;
+
+	if((p = config_get(config, NULL, "buffer")) != NULL)
+	{
+		tmp = strtol(p, &q, 10);
+		samples = (*p == '\0' || *q != '\0' || tmp <= 0) ? 1 : tmp;
+	}
+	/* by default, wait until every sample is likely to be there */
+	delay = damon->refresh * samples;
+	if((p = config_get(config, NULL, "buffer_delay")) != NULL)
+	{
+		tmp = strtol(p, &q, 10);
+		if(*p != '\0' && *q == '\0' && tmp > 0)
+			delay = tmp;
+	}
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() buffer=%u buffer_delay=%u\n", __func__,
+			samples, delay);
+#endif
+	if(damon_rrd_set_buffering(rrd, samples, delay) != 0)
+		damon_serror();
+	return (samples > 1) ? delay : 0;
+}
+
+static Store * _init_config_store(Config * config)
+{
+	Store * store;
+	String const * directory;
+	String const * p;
+	char * q;
+	int tmp;
+	unsigned int chunk = DAMON_DEFAULT_STORE_CHUNK;
+	unsigned int retention = DAMON_DEFAULT_STORE_RETENTION;
+
+	if((directory = config_get(config, NULL, "store")) == NULL)
+		return NULL;
+	if((p = config_get(config, NULL, "store_chunk")) != NULL)
+	{
+		tmp = strtol(p, &q, 10);
+		if(*p != '\0' && *q == '\0' && tmp > 0)
+			chunk = tmp;
+	}
+	if((p = config_get(config, NULL, "store_retention")) != NULL)
+	{
+		tmp = strtol(p, &q, 10);
+		if(*p != '\0' && *q == '\0' && tmp >= 0)
+			retention = tmp;
+	}
+	if((store = store_new(directory, chunk, retention * 86400)) == NULL)
+		damon_serror();
+	return store;
+}
+
 static int _init_config_hosts(DaMon * damon, Config * config,
 		String const * hosts)
 {
@@ -292,17 +747,72 @@ static int _init_config_hosts_host(DaMon * damon, Config * config, DaMonHost * h
 
 	host->damon = damon;
 	host->appclient = NULL;
+	host->address = NULL;
+	host->address_expiry = 0;
+	host->event = NULL;
+	host->expired = false;
+	host->broken = false;
+	host->unsupported = false;
+	host->deadline = 0;
+	host->failures = 0;
+	host->retry = 0;
+	host->snapshot = true;
+	host->history = true;
+	host->delta = true;
+	host->seq = 0;
+	host->backlog = NULL;
+	host->recorded = 0;
+	host->summary = true;
+	host->summary_seq = 0;
+	host->summarized = NULL;
+	host->push = true;
+	host->subscribed = false;
+	host->token[0] = '\0';
+	host->pushed = 0;
+	host->busy = false;
+	host->status = 0;
+	host->error[0] = '\0';
+	host->values = NULL;
 	host->ifaces = NULL;
+	host->ifaces_cnt = 0;
 	host->vols = NULL;
+	host->vols_cnt = 0;
+	host->discover = true;
+	host->ifaces_auto = false;
+	host->ifaces_generation = 0;
+	host->ifaces_listed = NULL;
+	host->vols_auto = false;
+	host->vols_generation = 0;
+	host->vols_listed = NULL;
+	host->samples = NULL;
+	host->samples_cnt = 0;
+	host->next = 0;
+	host->overruns = 0;
 	if((host->hostname = string_new_length(h, pos)) == NULL)
 		return damon_perror(NULL, -errno);
 #ifdef DEBUG
 	fprintf(stderr, "config: Host %s\n", host->hostname);
 #endif
+	/* "*" lets the Probe tell which ones it knows about */
 	if((p = config_get(config, host->hostname, "interfaces")) != NULL)
-		host->ifaces = _init_config_hosts_host_comma(p);
+	{
+		if(strcmp(p, "*") == 0)
+			host->ifaces_auto = true;
+		else
+			host->ifaces = _init_config_hosts_host_comma(p);
+	}
 	if((p = config_get(config, host->hostname, "volumes")) != NULL)
-		host->vols = _init_config_hosts_host_comma(p);
+	{
+		if(strcmp(p, "*") == 0)
+			host->vols_auto = true;
+		else
+			host->vols = _init_config_hosts_host_comma(p);
+	}
+	if(_init_config_hosts_host_samples(damon, host) != 0)
+	{
+		_destroy_host(host);
+		return -1;
+	}
 	return 0;
 }
 
@@ -353,20 +863,124 @@ static char ** _init_config_hosts_host_comma(char const * line)
 	return NULL;
 }
 
+static int _init_config_hosts_host_samples(DaMon * damon, DaMonHost * host)
+{
+	static const struct
+	{
+		RRDType type;
+		char const * name;
+	} samples[DAMON_SAMPLE_COUNT] =
+	{
+		{ RRDTYPE_UNKNOWN,	"uptime"	},
+		{ RRDTYPE_LOAD,		"load"		},
+		{ RRDTYPE_UNKNOWN,	"ram"		},
+		{ RRDTYPE_UNKNOWN,	"swap"		},
+		{ RRDTYPE_UNKNOWN,	"procs"		},
+		{ RRDTYPE_USERS,	"users"		}
+	};
+	size_t cnt;
+	size_t i;
+	size_t j;
+	RRDSample * sample;
 
-/* damon_destroy */
-static void _destroy_host(DaMonHost * host);
+	for(; host->ifaces != NULL && host->ifaces[host->ifaces_cnt] != NULL;
+			host->ifaces_cnt++);
+	for(; host->vols != NULL && host->vols[host->vols_cnt] != NULL;
+			host->vols_cnt++);
+	cnt = DAMON_SAMPLE_COUNT + host->ifaces_cnt + host->vols_cnt
+		+ DAMON_SAMPLE_COUNT * 2;
+	if((host->samples = malloc(sizeof(*host->samples) * cnt)) == NULL)
+		return damon_perror(NULL, -errno);
+	for(i = 0; i < cnt; i++)
+	{
+		sample = &host->samples[i];
+		sample->timestamp = 0;
+		sample->type = RRDTYPE_UNKNOWN;
+		sample->filename = NULL;
+		sample->values_cnt = 0;
+	}
+	host->samples_cnt = cnt;
+	/* intern the full path of every database */
+	for(i = 0; i < DAMON_SAMPLE_COUNT; i++)
+	{
+		sample = &host->samples[i];
+		sample->type = samples[i].type;
+		if((sample->filename = string_new_append(damon->prefix, "/",
+						host->hostname, "/",
+						samples[i].name, ".rrd", NULL))
+				== NULL)
+			return -1;
+	}
+	for(i = 0; i < host->ifaces_cnt; i++)
+	{
+		sample = &host->samples[DAMON_SAMPLE_COUNT + i];
+		if((sample->filename = string_new_append(damon->prefix, "/",
+						host->hostname, "/",
+						host->ifaces[i], ".rrd", NULL))
+				== NULL)
+			return -1;
+	}
+	for(i = 0; i < host->vols_cnt; i++)
+	{
+		sample = &host->samples[DAMON_SAMPLE_COUNT + host->ifaces_cnt
+			+ i];
+		sample->type = RRDTYPE_VOLUME;
+		if((sample->filename = string_new_append(damon->prefix, "/",
+						host->hostname, host->vols[i],
+						".rrd", NULL)) == NULL)
+			return -1;
+	}
+	/* kept apart, for the peaks not to be averaged away */
+	for(i = 0; i < DAMON_SAMPLE_COUNT * 2; i++)
+	{
+		sample = &host->samples[cnt - DAMON_SAMPLE_COUNT * 2 + i];
+		j = i % DAMON_SAMPLE_COUNT;
+		sample->type = samples[j].type;
+		if((sample->filename = string_new_append(damon->prefix, "/",
+						host->hostname, "/",
+						samples[j].name,
+						(i < DAMON_SAMPLE_COUNT)
+						? ".min.rrd" : ".max.rrd",
+						NULL)) == NULL)
+			return -1;
+	}
+	return 0;
+}
 
+/* damon_destroy */
 static void _damon_destroy(DaMon * damon)
 {
 	unsigned int i;
+	size_t j;
+	String * name;
 
+	event_unregister_timeout(damon->event,
+			(EventTimeoutFunc)_damon_on_schedule);
+	/* the backend may still be using the hosts */
+	if(damon->backend != NULL)
+		damon_backend_delete(damon->backend);
+	/* write whatever is still queued */
+	for(i = 0; i < damon->writers_cnt; i++)
+		writer_delete(damon->writers[i]);
+	free(damon->writers);
+	if(damon->names != NULL)
+	{
+		for(j = 0; (name = table_get_next(damon->names, &j)) != NULL;)
+			string_delete(name);
+		table_delete(damon->names);
+	}
 	for(i = 0; i < damon->hosts_cnt; i++)
 		_destroy_host(&damon->hosts[i]);
+	if(damon->store != NULL)
+		store_delete(damon->store);
+	if(damon->rrd != NULL)
+		damon_rrd_delete(damon->rrd);
 	if(damon->event_delete)
 		event_delete(damon->event);
+	free(damon->due);
 	free(damon->hosts);
-	string_delete(damon->rrdcached);
+	string_delete(damon->listen);
+	string_delete(damon->push);
 	string_delete(damon->prefix);
 }
 
@@ -375,4 +989,127 @@ static void _destroy_host(DaMonHost * host)
 	string_delete(host->hostname);
 	if(host->appclient != NULL)
 		appclient_delete(host->appclient);
+	if(host->event != NULL)
+		event_delete(host->event);
+	string_delete(host->address);
+	if(host->values != NULL)
+		snapshot_delete(host->values);
+	if(host->backlog != NULL)
+		buffer_delete(host->backlog);
+	free(host->summarized);
+	if(host->ifaces_listed != NULL)
+		buffer_delete(host->ifaces_listed);
+	if(host->vols_listed != NULL)
+		buffer_delete(host->vols_listed);
+	_destroy_host_samples(host->samples, host->samples_cnt);
+	_destroy_host_names(host->ifaces);
+	_destroy_host_names(host->vols);
+}
+
+static void _destroy_host_names(char ** names)
+{
+	size_t i;
+
+	for(i = 0; names != NULL && names[i] != NULL; i++)
+		free(names[i]);
+	free(names);
+}
+
+static void _destroy_host_samples(RRDSample * samples, size_t samples_cnt)
+{
+	size_t i;
+
+	for(i = 0; i < samples_cnt; i++)
+		string_delete((String *)samples[i].filename);
+	free(samples);
+}
+
+
+/* damon_intern */
+static char const * _intern_key(void const * entry);
+
+static String const * _damon_intern(DaMon * damon, char const * string,
+		size_t * hash)
+{
+	String * name;
+
+	*hash = table_hash(string);
+	if(damon->names == NULL
+			&& (damon->names = table_new(_intern_key)) == NULL)
+		return NULL;
+	if((name = table_get(damon->names, string)) != NULL)
+		return name;
+	if((name = string_new(string)) == NULL)
+		return NULL;
+	if(table_add(damon->names, name) != 0)
+	{
+		string_delete(name);
+		return NULL;
+	}
+	return name;
+}
+
+static char const * _intern_key(void const * entry)
+{
+	return entry;
+}
+
+
+/* damon_on_schedule */
+static unsigned long _schedule_next(uint64_t * next, uint64_t now,
+		uint64_t period);
+
+static int _damon_on_schedule(DaMon * damon)
+{
+	uint64_t now;
+	uint64_t period = (uint64_t)damon->refresh * 1000;
+	unsigned long missed;
+	unsigned long overruns = 0;
+	unsigned int i;
+	DaMonHost * host;
+	size_t cnt = 0;
+
+	if(damon_clock(&now) != 0)
+		return 0;
+	if(damon->hosts_cnt == 0)
+	{
+		if(now < damon->next)
+			return 0;
+		overruns = _schedule_next(&damon->next, now, period);
+	}
+	for(i = 0; i < damon->hosts_cnt; i++)
+	{
+		host = &damon->hosts[i];
+		if(now < host->next)
+			continue;
+		missed = _schedule_next(&host->next, now, period);
+		if(host->busy)
+			/* still polling from the previous slot */
+			missed++;
+		else
+			damon->due[cnt++] = host;
+		host->overruns += missed;
+		overruns += missed;
+	}
+	if(damon->hosts_cnt == 0 || cnt > 0)
+		damon_refresh(damon, damon->due, cnt);
+	if(overruns > 0)
+	{
+		damon->overruns += overruns;
+		error_set_print(PROGNAME_DAMON, 1, "%s%lu%s%lu%s",
+				"refresh: ", overruns, " overrun(s) (",
+				damon->overruns, " total)");
+	}
+	return 0;
+}
+
+static unsigned long _schedule_next(uint64_t * next, uint64_t now,
+		uint64_t period)
+{
+	uint64_t missed;
+
+	/* coalesce the slots missed, keeping the same phase */
+	missed = (now - *next) / period;
+	*next += (missed + 1) * period;
+	return missed;
 }
@@ -18,22 +18,81 @@
 #ifndef DAMON_DAMON_H
 # define DAMON_DAMON_H
 
+# include <stdint.h>
 # include <System.h>
 # include <System/App.h>
 # include "rrd.h"
+# include "snapshot.h"
 
 
 /* DaMon */
 /* types */
 typedef struct _DaMon DaMon;
 
+typedef struct _DaMonBackend DaMonBackend;
+
+typedef enum _DaMonSample
+{
+	DAMON_SAMPLE_UPTIME = 0,
+	DAMON_SAMPLE_LOAD,
+	DAMON_SAMPLE_RAM,
+	DAMON_SAMPLE_SWAP,
+	DAMON_SAMPLE_PROCS,
+	DAMON_SAMPLE_USERS
+} DaMonSample;
+# define DAMON_SAMPLE_LAST	DAMON_SAMPLE_USERS
+# define DAMON_SAMPLE_COUNT	(DAMON_SAMPLE_LAST + 1)
+
 typedef struct _DaMonHost
 {
 	DaMon * damon;
 	AppClient * appclient;
+	String * address;			/* resolved */
+	uint64_t address_expiry;
+	Event * event;
+	bool expired;
+	bool broken;				/* drop the connection */
+	bool unsupported;			/* by the Probe, last call */
+	uint64_t deadline;			/* monotonic, in milliseconds */
+	unsigned int failures;
+	uint64_t retry;
 	String * hostname;
+	bool snapshot;
+	bool history;
+	bool delta;
+	uint32_t seq;				/* of the last snapshot */
+	Buffer * backlog;			/* history to record */
+	time_t recorded;			/* the last time recorded */
+	bool summary;
+	uint32_t summary_seq;			/* of the last summary */
+	SnapshotSummary * summarized;		/* to record, if any */
+	bool push;
+	bool subscribed;
+	char token[33];				/* required with every push */
+	uint64_t pushed;
+	bool busy;
+	int status;
+	char error[256];			/* printed from the event loop */
+	Snapshot * values;
 	char ** ifaces;
+	size_t ifaces_cnt;
 	char ** vols;
+	size_t vols_cnt;
+	/* listed by the Probe, when configured as "*" */
+	bool discover;
+	bool ifaces_auto;
+	uint32_t ifaces_generation;
+	Buffer * ifaces_listed;			/* to apply */
+	bool vols_auto;
+	uint32_t vols_generation;
+	Buffer * vols_listed;			/* to apply */
+	/* one per DaMonSample, then per interface, then per volume, then
+	 * the minimum and the maximum of every DaMonSample between polls */
+	RRDSample * samples;
+	size_t samples_cnt;
+	/* next poll (monotonic, in milliseconds) */
+	uint64_t next;
+	unsigned long overruns;
 } DaMonHost;
 
 
@@ -43,17 +102,31 @@ DaMon * damon_new_event(char const * config, Event * event);
 void damon_delete(DaMon * damon);
 
 /* accessors */
+DaMonBackend * damon_get_backend(DaMon * damon);
+unsigned int damon_get_concurrency(DaMon * damon);
 Event * damon_get_event(DaMon * damon);
+unsigned int damon_get_refresh(DaMon * damon);
+unsigned int damon_get_timeout(DaMon * damon);
 
 DaMonHost * damon_get_host_by_id(DaMon * damon, size_t id);
+String const * damon_get_listen(DaMon * damon);
+String const * damon_get_prefix(DaMon * damon);
+String const * damon_get_push(DaMon * damon);
+
+int damon_set_host_names(DaMon * damon, DaMonHost * host, char ** ifaces,
+		char ** vols);
 
 /* useful */
+int damon_clock(uint64_t * now);
 int damon_error(char const * message, int error);
 int damon_perror(char const * message, int error);
 int damon_serror(void);
 
-int damon_refresh(DaMon * damon);
-int damon_update(DaMon * damon, RRDType type, char const * filename,
-		int args_cnt, ...);
+/* backend */
+DaMonBackend * damon_backend_new(DaMon * damon);
+void damon_backend_delete(DaMonBackend * backend);
+
+int damon_refresh(DaMon * damon, DaMonHost ** hosts, size_t hosts_cnt);
+int damon_update(DaMon * damon, RRDSample const * samples, size_t samples_cnt);
 
 #endif /* !DAMON_DAMON_H */
@@ -0,0 +1,138 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <System.h>
+#include "export.h"
+
+
+/* Export */
+/* private */
+/* types */
+struct _Export
+{
+	String * name;
+	ExportData * data;
+};
+
+
+/* public */
+/* functions */
+/* export_new */
+Export * export_new(char const * name)
+{
+	Export * export;
+	int fd;
+
+	if((export = object_new(sizeof(*export))) == NULL)
+		return NULL;
+	if((export->name = string_new(name)) == NULL)
+	{
+		object_delete(export);
+		return NULL;
+	}
+	if((fd = shm_open(name, O_RDWR | O_CREAT, 0644)) < 0)
+	{
+		error_set_code(-errno, "%s: %s", name, strerror(errno));
+		string_delete(export->name);
+		object_delete(export);
+		return NULL;
+	}
+	if(ftruncate(fd, sizeof(*export->data)) != 0
+			|| (export->data = mmap(NULL, sizeof(*export->data),
+					PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+					0)) == MAP_FAILED)
+	{
+		error_set_code(-errno, "%s: %s", name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		string_delete(export->name);
+		object_delete(export);
+		return NULL;
+	}
+	close(fd);
+	/* the readers check the magic last */
+	memset(export->data, 0, sizeof(*export->data));
+	export->data->version = EXPORT_VERSION;
+	__sync_synchronize();
+	memcpy(export->data->magic, EXPORT_MAGIC, sizeof(export->data->magic));
+	return export;
+}
+
+
+/* export_delete */
+void export_delete(Export * export)
+{
+	munmap(export->data, sizeof(*export->data));
+	shm_unlink(export->name);
+	string_delete(export->name);
+	object_delete(export);
+}
+
+
+/* useful */
+/* export_publish */
+void export_publish(Export * export, Snapshot const * snapshot, uint32_t seq,
+		time_t timestamp)
+{
+	ExportData * data = export->data;
+	size_t i;
+	size_t j;
+
+	data->sequence++;
+	__sync_synchronize();
+	data->seq = seq;
+	data->timestamp = timestamp;
+	data->uptime = snapshot->uptime;
+	memcpy(data->load, snapshot->load, sizeof(data->load));
+	memcpy(data->ram, snapshot->ram, sizeof(data->ram));
+	memcpy(data->swap, snapshot->swap, sizeof(data->swap));
+	data->procs = snapshot->procs;
+	data->users = snapshot->users;
+	/* the entries beyond the limits are left out, but counted */
+	data->ifaces_total = snapshot->ifaces_cnt;
+	for(i = 0, j = 0; i < snapshot->ifaces_cnt
+			&& j < EXPORT_INTERFACES_MAX; i++)
+	{
+		if(strlen(snapshot->ifaces[i].name)
+				>= sizeof(data->ifaces[j].name))
+			continue;
+		strcpy(data->ifaces[j].name, snapshot->ifaces[i].name);
+		data->ifaces[j].rxbytes = snapshot->ifaces[i].rxbytes;
+		data->ifaces[j++].txbytes = snapshot->ifaces[i].txbytes;
+	}
+	data->ifaces_cnt = j;
+	data->vols_total = snapshot->vols_cnt;
+	for(i = 0, j = 0; i < snapshot->vols_cnt && j < EXPORT_VOLUMES_MAX;
+			i++)
+	{
+		if(strlen(snapshot->vols[i].name)
+				>= sizeof(data->vols[j].name))
+			continue;
+		strcpy(data->vols[j].name, snapshot->vols[i].name);
+		data->vols[j].total = snapshot->vols[i].total;
+		data->vols[j++].free = snapshot->vols[i].free;
+	}
+	data->vols_cnt = j;
+	__sync_synchronize();
+	data->sequence++;
+}
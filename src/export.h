@@ -0,0 +1,94 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* The segment has a fixed size and layout, in host byte order. The writer
+ * increments the sequence before and after every update, so that readers
+ * can map it read-only and take a consistent copy without any call:
+ * - read the sequence, and start over while it is odd
+ * - copy the values needed
+ * - read the sequence again, and start over if it changed
+ * (with a memory barrier before and after the copy)
+ * The entries beyond the limits, or with longer names, are left out: the
+ * totals count them all. */
+
+
+
+#ifndef PROBE_EXPORT_H
+# define PROBE_EXPORT_H
+
+# include <stdint.h>
+# include <time.h>
+# include "snapshot.h"
+
+
+/* Export */
+/* constants */
+# define EXPORT_MAGIC		"ProbeShm"
+# define EXPORT_VERSION		2
+
+# define EXPORT_INTERFACES_MAX	64
+# define EXPORT_INTERFACE_NAME	32		/* with the terminating nul */
+# define EXPORT_VOLUMES_MAX	64
+# define EXPORT_VOLUME_NAME	256		/* with the terminating nul */
+
+
+/* types */
+typedef struct _Export Export;
+
+typedef struct _ExportInterface
+{
+	char name[EXPORT_INTERFACE_NAME];
+	uint64_t rxbytes;
+	uint64_t txbytes;
+} ExportInterface;
+
+typedef struct _ExportVolume
+{
+	char name[EXPORT_VOLUME_NAME];
+	uint64_t total;				/* in kilobytes */
+	uint64_t free;				/* in kilobytes */
+} ExportVolume;
+
+typedef struct _ExportData
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t sequence;			/* odd while updating */
+	uint32_t seq;				/* of the snapshot */
+	uint32_t padding;
+	int64_t timestamp;			/* of the snapshot */
+	uint64_t uptime;
+	uint64_t load[3];
+	uint64_t ram[4];			/* total, free, shared, buffer */
+	uint64_t swap[2];			/* total, free */
+	uint64_t procs;
+	uint64_t users;
+	uint32_t ifaces_total;			/* in the snapshot */
+	uint32_t ifaces_cnt;			/* at most EXPORT_INTERFACES_MAX */
+	uint32_t vols_total;			/* in the snapshot */
+	uint32_t vols_cnt;			/* at most EXPORT_VOLUMES_MAX */
+	ExportInterface ifaces[EXPORT_INTERFACES_MAX];
+	ExportVolume vols[EXPORT_VOLUMES_MAX];
+} ExportData;
+
+
+/* functions */
+Export * export_new(char const * name);
+void export_delete(Export * export);
+
+/* useful */
+void export_publish(Export * export, Snapshot const * snapshot, uint32_t seq,
+		time_t timestamp);
+
+#endif /* !PROBE_EXPORT_H */
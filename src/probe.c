@@ -20,16 +20,25 @@
 
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 #include <errno.h>
+#include <pthread.h>
 #include <System.h>
 #include <System/App.h>
 #include "../data/Probe.h"
+#include "export.h"
+#include "snapshot.h"
+#include "table.h"
 #include "../config.h"
 
+#ifndef APPSERVER_DAMON_NAME
+# define APPSERVER_DAMON_NAME	"DaMon"
+#endif
 #ifndef APPSERVER_PROBE_NAME
 # define APPSERVER_PROBE_NAME	PACKAGE
 #endif
@@ -61,6 +70,11 @@
 #endif
 
 #define PROBE_REFRESH 10
+#define PROBE_HISTORY_BATCH 512
+#define PROBE_HISTORY_DEPTH 360
+#define PROBE_NAMES_EXPIRY 360
+#define PROBE_PUSH_TIMEOUT 2
+#define PROBE_SUBSCRIBERS_MAX 32
 
 
 /* functions */
@@ -309,7 +323,7 @@ static int _userinfo_utmpx(unsigned int * userinfo)
 /* ifinfo */
 struct ifinfo
 {
-	char name[6];
+	char name[SNAPSHOT_INTERFACE_NAME];
 	unsigned int ibytes;
 	unsigned int obytes;
 };
@@ -367,11 +381,17 @@ static int _ifinfo_linux_append(struct ifinfo ** dev, char * buf, int nb)
 	if((p = realloc(*dev, sizeof(*p) * (nb + 1))) == NULL)
 		return _probe_perror(NULL, 1);
 	*dev = p;
-	for(i = 0; i < sizeof(p->name) && buf[i] != '\0'; i++);
-	if(i != sizeof(p->name))
-		return 1;
-	buf[sizeof(p->name)] = '\0';
+	/* the name is only aligned on six columns when short enough */
 	for(q = buf; q[0] == ' '; q++);
+	for(i = q - buf; buf[i] != '\0' && buf[i] != ':'; i++);
+	if(buf[i] == '\0')
+		return 1;
+	buf[i] = '\0';
+	if(string_get_length(q) >= sizeof(p[nb].name))
+	{
+		errno = ENAMETOOLONG;
+		return 1;
+	}
 	strcpy(p[nb].name, q);
 # if defined(DEBUG)
 	fprintf(stderr, "_ifinfo_append: %s\n", p[nb].name);
@@ -441,6 +461,11 @@ static int _ifinfo_bsd_append(struct ifinfo ** dev, char * ifname, int fd,
 	struct ifdatareq ifdr;
 	struct ifinfo * p;
 
+	if(strlen(ifname) >= sizeof(ifdr.ifdr_name))
+	{
+		errno = ENAMETOOLONG;
+		return 1;
+	}
 	strcpy(ifdr.ifdr_name, ifname);
 	if(ioctl(fd, SIOCGIFDATA, &ifdr) == -1)
 		return _probe_perror("SIOCGIFDATA", 1);
@@ -471,7 +496,7 @@ static int _ifinfo_generic(struct ifinfo ** dev)
 /* volinfo */
 struct volinfo
 {
-	char name[256];
+	char name[SNAPSHOT_VOLUME_NAME];
 	unsigned long block_size;
 	unsigned long total;
 	unsigned long free;
@@ -533,8 +558,11 @@ static int _volinfo_mtab_append(struct volinfo ** dev, char * buf, int nb)
 		return 1;
 	*dev = p;
 	memset(&p[nb], 0, sizeof(struct volinfo));
-	if(j-i >= sizeof(p[nb].name)-1)
+	if(j-i >= sizeof(p[nb].name))
+	{
+		errno = ENAMETOOLONG;
 		return 1;
+	}
 	strncpy(p[nb].name, &buf[i], j-i);
 	p[nb].name[j-i] = '\0';
 # if defined(DEBUG)
@@ -572,6 +600,11 @@ static int _volinfo_statfs_append(struct volinfo ** dev, struct statfs * buf,
 	if((p = realloc(*dev, sizeof(*p) * (nb + 1))) == NULL)
 		return _probe_perror(NULL, 1);
 	*dev = p;
+	if(strlen(buf->f_mntonname) >= sizeof(p[nb].name))
+	{
+		errno = ENAMETOOLONG;
+		return 1;
+	}
 	strcpy(p[nb].name, buf->f_mntonname);
 # if defined(DEBUG)
 	fprintf(stderr, "_volinfo_append: %s\n", p[nb].name);
@@ -624,6 +657,11 @@ static int _volinfo_statvfs_append(struct volinfo ** dev, struct statvfs * buf,
 	if((p = realloc(*dev, sizeof(*p) * (nb + 1))) == NULL)
 		return _probe_perror(NULL, 1);
 	*dev = p;
+	if(strlen(buf->f_mntonname) >= sizeof(p[nb].name))
+	{
+		errno = ENAMETOOLONG;
+		return 1;
+	}
 	strcpy(p[nb].name, buf->f_mntonname);
 # if defined(DEBUG)
 	fprintf(stderr, "_volinfo_append: %s\n", p[nb].name);
@@ -649,95 +687,313 @@ static int _volinfo_generic(struct volinfo ** dev)
 /* Probe */
 /* private */
 /* types */
-typedef struct _App
+typedef struct _App Probe;
+
+typedef struct _ProbeSubscriber
+{
+	String * address;
+	String * name;
+	String * token;				/* sent back with every push */
+	AppClient * appclient;
+} ProbeSubscriber;
+
+typedef struct _ProbeIndexPosition
+{
+	uint32_t id;
+	size_t pos;
+} ProbeIndexPosition;
+
+typedef struct _ProbeIndex
+{
+	/* entries of the snapshot, hashed by name (the first one wins) */
+	Table * entries;
+	/* identifiers by position */
+	uint32_t * ids;
+	size_t cnt;
+	/* positions of the distinct names, sorted by identifier */
+	ProbeIndexPosition * positions;
+	size_t positions_cnt;
+	uint32_t generation;			/* of the set of names */
+} ProbeIndex;
+
+typedef struct _ProbeName
+{
+	String * name;
+	uint32_t id;
+	uint32_t seen;				/* when last indexed */
+} ProbeName;
+
+typedef struct _ProbeNames
+{
+	/* the names seen lately, hashed */
+	Table * names;
+	uint32_t next;				/* identifier */
+	uint32_t indexed;			/* snapshots */
+	/* the set of names last indexed */
+	uint32_t generation;
+	uint32_t * ids;
+	size_t ids_cnt;
+} ProbeNames;
+
+typedef struct _ProbeHistory
+{
+	time_t timestamp;
+	Snapshot * snapshot;
+	Buffer * encoded;			/* as sent, shared by the clients */
+	/* for the latest snapshot only */
+	ProbeIndex * ifaces;
+	ProbeIndex * vols;
+} ProbeHistory;
+
+typedef struct _ProbeServer
+{
+	Probe * probe;
+	String const * name;
+	Event * event;
+	AppServer * appserver;
+	pthread_t thread;
+} ProbeServer;
+
+struct _App
 {
+	/* collected from the thread only */
 	struct sysinfo sysinfo;
 	unsigned int users;
 	struct ifinfo * ifinfo;
 	unsigned int ifinfo_cnt;
 	struct volinfo * volinfo;
 	unsigned int volinfo_cnt;
-} Probe;
+	ProbeNames ifaces_names;
+	ProbeNames vols_names;
+
+	/* collection */
+	unsigned int refresh;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool quit;
+	int fds[2];				/* snapshots collected */
+
+	/* serving, from as many threads */
+	ProbeServer * servers;
+	size_t servers_cnt;
+
+	/* recent snapshots, for deltas and the history */
+	pthread_rwlock_t lock;
+	uint32_t seq;
+	ProbeHistory * history;
+	size_t history_size;
+
+	/* for the local readers */
+	Export * export;
+
+	/* pushing snapshots */
+	String const ** pushes;			/* addresses allowed */
+	size_t pushes_cnt;
+	pthread_mutex_t subscribers_mutex;
+	ProbeSubscriber * subscribers;
+	size_t subscribers_cnt;
+	/* from a thread of its own, not to hold the main loop */
+	pthread_t push_thread;
+	pthread_cond_t push_cond;		/* with subscribers_mutex */
+	uint32_t push_seq;			/* to push next */
+	bool push_quit;
+	Event * push_event;			/* for the timeouts */
+	bool push_expired;
+};
 
 
 /* prototypes */
+static void _probe_cleanup(Probe * probe);
+static int _probe_collect(Probe * probe, ProbeHistory * entry);
 static int _probe_error(int ret);
+static void _probe_history_delete(ProbeHistory * entry);
+static ProbeHistory * _probe_history_get(Probe * probe, uint32_t seq);
+static ProbeIndex * _probe_index_new_interfaces(ProbeNames * names,
+		Snapshot * snapshot);
+static ProbeIndex * _probe_index_new_volumes(ProbeNames * names,
+		Snapshot * snapshot);
+static void _probe_index_delete(ProbeIndex * index);
+static int _probe_index_find_id(ProbeIndex const * index, uint32_t id,
+		size_t * pos);
+static int _probe_index_find_interface(ProbeIndex const * index,
+		Snapshot const * snapshot, char const * name, size_t * pos);
+static int _probe_index_find_volume(ProbeIndex const * index,
+		Snapshot const * snapshot, char const * name, size_t * pos);
+static bool _probe_index_is_first(ProbeIndex const * index, size_t pos);
+static void _probe_names_cleanup(ProbeNames * names);
+static void _probe_names_expire(ProbeNames * names);
+static int _probe_names_get(ProbeNames * names, char const * name,
+		uint32_t * id);
+static int _probe_on_collected(int fd, Probe * probe);
 static int _probe_perror(char const * message, int ret);
-static int _probe_timeout(Probe * probe);
+static int _probe_serve(Probe * probe, AppServerOptions options,
+		String const ** names, size_t names_cnt);
+static void _probe_serve_stop(Probe * probe);
+static void _probe_publish(Probe * probe, ProbeHistory const * entry);
+static void _probe_push(Probe * probe, uint32_t seq);
+static int _probe_push_start(Probe * probe);
+static void _probe_push_stop(Probe * probe);
+static void * _probe_push_thread(void * data);
+static Snapshot * _probe_snapshot(Probe * probe);
+static Snapshot * _probe_snapshot_get(Probe * probe, uint32_t seq);
+static void _probe_subscriber_delete(Probe * probe, size_t i);
+static void * _probe_thread(void * data);
 
 
 /* functions */
 /* probe */
-static int _probe(AppServerOptions options)
+static int _probe_start(Probe * probe, Event * event);
+static void _probe_stop(Probe * probe, Event * event);
+
+static int _probe(AppServerOptions options, unsigned int refresh,
+		size_t depth, String const ** names, size_t names_cnt,
+		String const ** pushes, size_t pushes_cnt, String const * shm)
 {
 	Probe probe;
-	AppServer * appserver;
+	ProbeHistory entry;
+	AppServer * appserver = NULL;
 	Event * event;
-	struct timeval tv;
 
 	memset(&probe, 0, sizeof(probe));
-	if(_probe_timeout(&probe) != 0)
+	probe.refresh = refresh;
+	probe.pushes = pushes;
+	probe.pushes_cnt = pushes_cnt;
+	probe.fds[0] = -1;
+	probe.fds[1] = -1;
+	pthread_mutex_init(&probe.mutex, NULL);
+	pthread_cond_init(&probe.cond, NULL);
+	pthread_rwlock_init(&probe.lock, NULL);
+	pthread_mutex_init(&probe.subscribers_mutex, NULL);
+	pthread_cond_init(&probe.push_cond, NULL);
+	/* so that the sequence numbers differ after a restart */
+	probe.seq = time(NULL);
+	probe.ifaces_names.generation = probe.seq;
+	probe.vols_names.generation = probe.seq;
+	if((probe.history = calloc(depth, sizeof(*probe.history))) == NULL)
+	{
+		_probe_cleanup(&probe);
+		return _probe_perror(NULL, 1);
+	}
+	probe.history_size = depth;
+	if(shm != NULL && (probe.export = export_new(shm)) == NULL)
+	{
+		_probe_cleanup(&probe);
+		return _probe_error(1);
+	}
+	/* the first snapshot is available right away */
+	if(_probe_collect(&probe, &entry) != 0)
 	{
-		free(probe.ifinfo);
-		free(probe.volinfo);
+		_probe_cleanup(&probe);
 		return 1;
 	}
+	_probe_publish(&probe, &entry);
 	if((event = event_new()) == NULL)
 	{
-		free(probe.ifinfo);
-		free(probe.volinfo);
+		_probe_cleanup(&probe);
 		return _probe_error(1);
 	}
-	if((appserver = appserver_new_event(&probe, options,
-					APPSERVER_PROBE_NAME, NULL, event))
-			== NULL)
+	/* served from the main loop unless listening to given names */
+	if((names_cnt == 0 && (appserver = appserver_new_event(&probe,
+						options, APPSERVER_PROBE_NAME,
+						NULL, event)) == NULL)
+			|| (names_cnt > 0 && _probe_serve(&probe, options,
+					names, names_cnt) != 0))
 	{
-		free(probe.ifinfo);
-		free(probe.volinfo);
+		_probe_cleanup(&probe);
 		event_delete(event);
 		return _probe_error(1);
 	}
-	tv.tv_sec = PROBE_REFRESH;
-	tv.tv_usec = 0;
-	if(event_register_timeout(event, &tv, (EventTimeoutFunc)_probe_timeout,
-			&probe) != 0)
-		_probe_error(0);
-	else
+	if(_probe_start(&probe, event) == 0)
+	{
 		event_loop(event);
-	appserver_delete(appserver);
+		_probe_stop(&probe, event);
+	}
+	_probe_serve_stop(&probe);
+	if(appserver != NULL)
+		appserver_delete(appserver);
 	event_delete(event);
-	free(probe.ifinfo);
-	free(probe.volinfo);
+	_probe_cleanup(&probe);
 	return 1;
 }
 
+static int _probe_start(Probe * probe, Event * event)
+{
+	if(_probe_push_start(probe) != 0)
+		return 1;
+	if(pipe(probe->fds) != 0)
+	{
+		_probe_push_stop(probe);
+		return _probe_perror("pipe", 1);
+	}
+	if((errno = pthread_create(&probe->thread, NULL, _probe_thread,
+					probe)) != 0)
+	{
+		_probe_perror("pthread_create", 1);
+		close(probe->fds[0]);
+		close(probe->fds[1]);
+		_probe_push_stop(probe);
+		return 1;
+	}
+	event_register_io_read(event, probe->fds[0],
+			(EventIOFunc)_probe_on_collected, probe);
+	return 0;
+}
 
-/* probe_error */
-static int _probe_error(int ret)
+static void _probe_stop(Probe * probe, Event * event)
 {
-	error_print(PROGNAME_PROBE);
-	return ret;
+	/* the servers quit as well */
+	pthread_mutex_lock(&probe->mutex);
+	probe->quit = true;
+	pthread_cond_signal(&probe->cond);
+	pthread_mutex_unlock(&probe->mutex);
+	pthread_join(probe->thread, NULL);
+	event_unregister_io_read(event, probe->fds[0]);
+	/* the snapshots still in the pipe are lost */
+	_probe_on_collected(-1, probe);
+	close(probe->fds[0]);
+	close(probe->fds[1]);
+	_probe_push_stop(probe);
 }
 
 
-/* probe_perror */
-static int _probe_perror(char const * message, int ret)
+/* probe_cleanup */
+static void _probe_cleanup(Probe * probe)
 {
-	error_set_print(PROGNAME_PROBE, ret, "%s%s%s", message ? message : "",
-			message ? ": " : "", strerror(errno));
-	return ret;
+	size_t i;
+
+	while(probe->subscribers_cnt > 0)
+		_probe_subscriber_delete(probe, probe->subscribers_cnt - 1);
+	free(probe->subscribers);
+	if(probe->push_event != NULL)
+		event_delete(probe->push_event);
+	for(i = 0; i < probe->history_size; i++)
+		_probe_history_delete(&probe->history[i]);
+	free(probe->history);
+	free(probe->ifinfo);
+	free(probe->volinfo);
+	_probe_names_cleanup(&probe->ifaces_names);
+	_probe_names_cleanup(&probe->vols_names);
+	if(probe->export != NULL)
+		export_delete(probe->export);
+	pthread_cond_destroy(&probe->push_cond);
+	pthread_mutex_destroy(&probe->subscribers_mutex);
+	pthread_rwlock_destroy(&probe->lock);
+	pthread_cond_destroy(&probe->cond);
+	pthread_mutex_destroy(&probe->mutex);
 }
 
 
-/* probe_timeout */
-static int _probe_timeout(Probe * probe)
+/* probe_collect */
+static int _probe_collect(Probe * probe, ProbeHistory * entry)
 {
 	int i;
 #if defined(DEBUG)
 	static unsigned int count = 0;
 
-	fprintf(stderr, "%s%d%s", "_probe_timeout(", count++, ")\n");
+	fprintf(stderr, "%s%d%s", "_probe_collect(", count++, ")\n");
 #endif
+	entry->timestamp = time(NULL);
 	if(_sysinfo(&probe->sysinfo) != 0)
 		return _probe_perror("sysinfo", 1);
 	if(_userinfo(&probe->users) != 0)
@@ -748,205 +1004,1517 @@ static int _probe_timeout(Probe * probe)
 	if((i = _volinfo(&probe->volinfo)) < 0)
 		return _probe_perror("volinfo", 1);
 	probe->volinfo_cnt = i;
+	if((entry->snapshot = _probe_snapshot(probe)) == NULL)
+		return _probe_error(1);
+	/* encoded once for every client */
+	entry->encoded = NULL;
+	entry->ifaces = NULL;
+	entry->vols = NULL;
+	if((entry->encoded = buffer_new(0, NULL)) == NULL
+			|| snapshot_encode(entry->snapshot, entry->encoded)
+			!= 0
+			/* looked up by name or identifier */
+			|| (entry->ifaces = _probe_index_new_interfaces(
+					&probe->ifaces_names, entry->snapshot))
+			== NULL
+			|| (entry->vols = _probe_index_new_volumes(
+					&probe->vols_names, entry->snapshot))
+			== NULL)
+	{
+		_probe_history_delete(entry);
+		return _probe_error(1);
+	}
 	return 0;
 }
 
 
-/* public */
-/* functions */
-/* AppInterface */
-/* Probe_uptime */
-uint32_t Probe_uptime(Probe * probe, AppServerClient * asc)
+/* probe_error */
+static int _probe_error(int ret)
 {
-	(void) asc;
-
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %ld\n", __func__, probe->sysinfo.uptime);
-#endif
-	return probe->sysinfo.uptime;
+	error_print(PROGNAME_PROBE);
+	return ret;
 }
 
 
-/* Probe_load */
-int32_t Probe_load(Probe * probe, AppServerClient * asc, uint32_t * load1,
-		uint32_t * load5, uint32_t * load15)
+/* probe_history_delete */
+static void _probe_history_delete(ProbeHistory * entry)
 {
-	(void) asc;
+	if(entry->snapshot != NULL)
+		snapshot_delete(entry->snapshot);
+	if(entry->encoded != NULL)
+		buffer_delete(entry->encoded);
+	if(entry->ifaces != NULL)
+		_probe_index_delete(entry->ifaces);
+	if(entry->vols != NULL)
+		_probe_index_delete(entry->vols);
+	entry->snapshot = NULL;
+	entry->encoded = NULL;
+	entry->ifaces = NULL;
+	entry->vols = NULL;
+}
 
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %lu %lu %lu\n", __func__, probe->sysinfo.loads[0],
-			probe->sysinfo.loads[1], probe->sysinfo.loads[2]);
-#endif
-	*load1 = probe->sysinfo.loads[0];
-	*load5 = probe->sysinfo.loads[1];
-	*load15 = probe->sysinfo.loads[2];
-	return 0;
+
+/* probe_history_get */
+static ProbeHistory * _probe_history_get(Probe * probe, uint32_t seq)
+{
+	if(seq == 0 || (uint32_t)(probe->seq - seq) >= probe->history_size
+			|| probe->history[seq % probe->history_size].snapshot
+			== NULL)
+		return NULL;
+	return &probe->history[seq % probe->history_size];
 }
 
 
-/* Probe_ram */
-int32_t Probe_ram(Probe * probe, AppServerClient * asc, uint32_t * total,
-		uint32_t * free, uint32_t * shared, uint32_t * buffer)
+/* probe_index_new */
+static ProbeIndex * _index_new(ProbeNames * names, TableKeyFunc key,
+		size_t cnt);
+static int _index_new_add(ProbeIndex * index, ProbeNames * names, size_t pos,
+		void * entry, char const * name);
+static int _index_new_done(ProbeIndex * index, ProbeNames * names);
+static int _index_new_compare(void const * a, void const * b);
+static char const * _index_new_interface_key(void const * entry);
+static char const * _index_new_volume_key(void const * entry);
+
+static ProbeIndex * _probe_index_new_interfaces(ProbeNames * names,
+		Snapshot * snapshot)
 {
-	(void) asc;
+	ProbeIndex * index;
+	size_t i;
 
-#if defined(DEBUG)
-	fprintf(stderr, "%s() total %lu, free %lu, shared %lu, buffered %lu\n",
-			__func__, probe->sysinfo.totalram,
-			probe->sysinfo.freeram, probe->sysinfo.sharedram,
-			probe->sysinfo.bufferram);
-#endif
-	*total = probe->sysinfo.totalram;
-	*free = probe->sysinfo.freeram;
-	*shared = probe->sysinfo.sharedram;
-	*buffer = probe->sysinfo.bufferram;
-	return 0;
+	if((index = _index_new(names, _index_new_interface_key,
+					snapshot->ifaces_cnt)) == NULL)
+		return NULL;
+	for(i = 0; i < snapshot->ifaces_cnt; i++)
+		if(_index_new_add(index, names, i, &snapshot->ifaces[i],
+					snapshot->ifaces[i].name) != 0)
+		{
+			_probe_index_delete(index);
+			return NULL;
+		}
+	if(_index_new_done(index, names) != 0)
+	{
+		_probe_index_delete(index);
+		return NULL;
+	}
+	return index;
 }
 
+static ProbeIndex * _probe_index_new_volumes(ProbeNames * names,
+		Snapshot * snapshot)
+{
+	ProbeIndex * index;
+	size_t i;
 
-/* Probe_swap */
-int32_t Probe_swap(Probe * probe, AppServerClient * asc, uint32_t * total,
-		uint32_t * free)
+	if((index = _index_new(names, _index_new_volume_key,
+					snapshot->vols_cnt)) == NULL)
+		return NULL;
+	for(i = 0; i < snapshot->vols_cnt; i++)
+		if(_index_new_add(index, names, i, &snapshot->vols[i],
+					snapshot->vols[i].name) != 0)
+		{
+			_probe_index_delete(index);
+			return NULL;
+		}
+	if(_index_new_done(index, names) != 0)
+	{
+		_probe_index_delete(index);
+		return NULL;
+	}
+	return index;
+}
+
+static ProbeIndex * _index_new(ProbeNames * names, TableKeyFunc key,
+		size_t cnt)
 {
-	(void) asc;
+	ProbeIndex * index;
+
+	if((index = object_new(sizeof(*index))) == NULL)
+		return NULL;
+	index->entries = table_new(key);
+	index->ids = malloc(sizeof(*index->ids) * (cnt + 1));
+	index->cnt = cnt;
+	index->positions = malloc(sizeof(*index->positions) * (cnt + 1));
+	index->positions_cnt = 0;
+	if(index->entries == NULL || index->ids == NULL
+			|| index->positions == NULL)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		_probe_index_delete(index);
+		return NULL;
+	}
+	names->indexed++;
+	return index;
+}
 
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %lu/%lu\n", __func__,
-			probe->sysinfo.totalswap - probe->sysinfo.freeswap,
-			probe->sysinfo.totalswap);
-#endif
-	*total = probe->sysinfo.totalswap;
-	*free = probe->sysinfo.freeswap;
+static int _index_new_add(ProbeIndex * index, ProbeNames * names, size_t pos,
+		void * entry, char const * name)
+{
+	ProbeIndexPosition * p;
+
+	if(_probe_names_get(names, name, &index->ids[pos]) != 0)
+		return -1;
+	/* the first entry of a given name wins */
+	if(table_get(index->entries, name) != NULL)
+		return 0;
+	if(table_add(index->entries, entry) != 0)
+		return -1;
+	p = &index->positions[index->positions_cnt++];
+	p->id = index->ids[pos];
+	p->pos = pos;
 	return 0;
 }
 
+static int _index_new_done(ProbeIndex * index, ProbeNames * names)
+{
+	uint32_t * ids;
+	size_t i;
+	bool changed;
+	size_t pos;
 
-/* Probe_procs */
-uint32_t Probe_procs(Probe * probe, AppServerClient * asc)
+	qsort(index->positions, index->positions_cnt,
+			sizeof(*index->positions), _index_new_compare);
+	/* the distinct names */
+	if((ids = malloc(sizeof(*ids) * (index->positions_cnt + 1))) == NULL)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		return -1;
+	}
+	for(i = 0; i < index->positions_cnt; i++)
+		ids[i] = index->positions[i].id;
+	changed = (index->positions_cnt != names->ids_cnt);
+	for(i = 0; !changed && i < names->ids_cnt; i++)
+		changed = (_probe_index_find_id(index, names->ids[i], &pos)
+				!= 0);
+	if(changed && ++names->generation == 0)
+		names->generation++;
+	free(names->ids);
+	names->ids = ids;
+	names->ids_cnt = index->positions_cnt;
+	index->generation = names->generation;
+	_probe_names_expire(names);
+	return 0;
+}
+
+static int _index_new_compare(void const * a, void const * b)
 {
-	(void) asc;
+	ProbeIndexPosition const * pa = a;
+	ProbeIndexPosition const * pb = b;
 
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %u\n", __func__, probe->sysinfo.procs);
-#endif
-	return probe->sysinfo.procs;
+	return (pa->id < pb->id) ? -1 : ((pa->id > pb->id) ? 1 : 0);
 }
 
+static char const * _index_new_interface_key(void const * entry)
+{
+	SnapshotInterface const * iface = entry;
+
+	return iface->name;
+}
 
-/* Probe_users */
-uint32_t Probe_users(Probe * probe, AppServerClient * asc)
+static char const * _index_new_volume_key(void const * entry)
 {
-	(void) asc;
+	SnapshotVolume const * vol = entry;
 
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %u\n", __func__, probe->users);
-#endif
-	return probe->users;
+	return vol->name;
 }
 
 
-/* Probe_ifrxbytes */
-uint32_t Probe_ifrxbytes(Probe * probe, AppServerClient * asc,
-		String const * dev)
+/* probe_index_delete */
+static void _probe_index_delete(ProbeIndex * index)
 {
-	unsigned int i;
-	(void) asc;
+	if(index->entries != NULL)
+		table_delete(index->entries);
+	free(index->ids);
+	free(index->positions);
+	object_delete(index);
+}
+
+
+/* probe_index_find_id */
+static int _probe_index_find_id(ProbeIndex const * index, uint32_t id,
+		size_t * pos)
+{
+	ProbeIndexPosition key;
+	ProbeIndexPosition const * p;
 
-	for(i = 0; i < probe->ifinfo_cnt
-			&& string_compare(probe->ifinfo[i].name, dev) != 0; i++);
-	if(i == probe->ifinfo_cnt)
+	key.id = id;
+	if((p = bsearch(&key, index->positions, index->positions_cnt,
+					sizeof(*index->positions),
+					_index_new_compare)) == NULL)
 		return -1;
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %s %u\n", __func__, probe->ifinfo[i].name,
-			probe->ifinfo[i].ibytes);
-#endif
-	return probe->ifinfo[i].ibytes;
+	*pos = p->pos;
+	return 0;
 }
 
 
-/* Probe_iftxbytes */
-uint32_t Probe_iftxbytes(Probe * probe, AppServerClient * asc,
-		String const * dev)
+/* probe_index_find_interface */
+static int _probe_index_find_interface(ProbeIndex const * index,
+		Snapshot const * snapshot, char const * name, size_t * pos)
 {
-	unsigned int i;
-	(void) asc;
+	SnapshotInterface const * iface;
 
-	for(i = 0; i < probe->ifinfo_cnt
-			&& string_compare(probe->ifinfo[i].name, dev) != 0; i++);
-	if(i == probe->ifinfo_cnt)
+	if((iface = table_get(index->entries, name)) == NULL)
 		return -1;
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %s %u\n", __func__, probe->ifinfo[i].name,
-			probe->ifinfo[i].obytes);
-#endif
-	return probe->ifinfo[i].obytes;
+	*pos = iface - snapshot->ifaces;
+	return 0;
 }
 
 
-/* Probe_voltotal */
-uint32_t Probe_voltotal(Probe * probe, AppServerClient * asc,
-		String const * volume)
+/* probe_index_find_volume */
+static int _probe_index_find_volume(ProbeIndex const * index,
+		Snapshot const * snapshot, char const * name, size_t * pos)
 {
-	unsigned int i;
-	(void) asc;
+	SnapshotVolume const * vol;
 
-	for(i = 0; i < probe->volinfo_cnt
-			&& string_compare(probe->volinfo[i].name, volume) != 0;
-			i++);
-	if(i == probe->volinfo_cnt)
+	if((vol = table_get(index->entries, name)) == NULL)
 		return -1;
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %s %lu\n", __func__, probe->volinfo[i].name,
-			probe->volinfo[i].total);
-#endif
-	return probe->volinfo[i].total * (probe->volinfo[i].block_size / 1024);
+	*pos = vol - snapshot->vols;
+	return 0;
 }
 
 
-/* Probe_volfree */
-uint32_t Probe_volfree(Probe * probe, AppServerClient * asc,
-		String const * volume)
+/* probe_index_is_first */
+static bool _probe_index_is_first(ProbeIndex const * index, size_t pos)
 {
-	unsigned int i;
-	(void) asc;
+	size_t first;
 
-	for(i = 0; i < probe->volinfo_cnt
-			&& string_compare(probe->volinfo[i].name, volume) != 0;
-			i++);
-	if(i == probe->volinfo_cnt)
-		return -1;
-#if defined(DEBUG)
-	fprintf(stderr, "%s() %s %lu\n", __func__, probe->volinfo[i].name,
-			probe->volinfo[i].free);
-#endif
-	return probe->volinfo[i].free * (probe->volinfo[i].block_size / 1024);
+	/* of the entries with this name */
+	return (_probe_index_find_id(index, index->ids[pos], &first) == 0
+			&& first == pos) ? true : false;
 }
 
 
-/* usage */
-static int _usage(void)
+/* probe_names_cleanup */
+static void _probe_names_cleanup(ProbeNames * names)
 {
-	fputs("Usage: " PROGNAME_PROBE " [-R]\n", stderr);
-	return 1;
+	size_t i;
+	ProbeName * name;
+
+	if(names->names != NULL)
+	{
+		for(i = 0; (name = table_get_next(names->names, &i)) != NULL;)
+		{
+			string_delete(name->name);
+			object_delete(name);
+		}
+		table_delete(names->names);
+	}
+	free(names->ids);
 }
 
 
-/* main */
-int main(int argc, char * argv[])
+/* probe_names_expire */
+static void _probe_names_expire(ProbeNames * names)
 {
-	int o;
-	AppServerOptions options = 0;
+	ProbeName ** expired;
+	size_t expired_cnt = 0;
+	size_t i;
+	ProbeName * name;
 
-	while((o = getopt(argc, argv, "R")) != -1)
-		switch(o)
+	/* forget the names gone for a while, from time to time */
+	if(names->names == NULL || names->indexed % PROBE_NAMES_EXPIRY != 0
+			|| (expired = malloc(sizeof(*expired)
+					* table_get_count(names->names)))
+			== NULL)
+		return;
+	for(i = 0; (name = table_get_next(names->names, &i)) != NULL;)
+		if(names->indexed - name->seen >= PROBE_NAMES_EXPIRY)
+			expired[expired_cnt++] = name;
+	for(i = 0; i < expired_cnt; i++)
+	{
+		table_remove(names->names, expired[i]->name);
+		string_delete(expired[i]->name);
+		object_delete(expired[i]);
+	}
+	free(expired);
+}
+
+
+/* probe_names_get */
+static char const * _names_get_key(void const * entry);
+
+static int _probe_names_get(ProbeNames * names, char const * name,
+		uint32_t * id)
+{
+	ProbeName * n;
+
+	if(names->names == NULL
+			&& (names->names = table_new(_names_get_key)) == NULL)
+		return -1;
+	if((n = table_get(names->names, name)) == NULL)
+	{
+		if((n = object_new(sizeof(*n))) == NULL)
+			return -1;
+		if((n->name = string_new(name)) == NULL
+				|| table_add(names->names, n) != 0)
 		{
-			case 'R':
-				options = ASO_REGISTER;
-				break;
-			default:
-				return _usage();
+			string_delete(n->name);
+			object_delete(n);
+			return -1;
 		}
-	if(optind != argc)
-		return _usage();
-	return (_probe(options) == 0) ? 0 : 2;
+		/* identifiers are never reused */
+		n->id = names->next++;
+	}
+	n->seen = names->indexed;
+	*id = n->id;
+	return 0;
+}
+
+static char const * _names_get_key(void const * entry)
+{
+	ProbeName const * name = entry;
+
+	return name->name;
+}
+
+
+/* probe_on_collected */
+static int _probe_on_collected(int fd, Probe * probe)
+{
+	ProbeHistory entries[16];
+	ssize_t size;
+	size_t i;
+
+	/* discard whatever is left */
+	if(fd < 0)
+	{
+		fcntl(probe->fds[0], F_SETFL, O_NONBLOCK);
+		while((size = read(probe->fds[0], entries, sizeof(entries)))
+				> 0)
+			for(i = 0; i < size / sizeof(*entries); i++)
+				_probe_history_delete(&entries[i]);
+		return 0;
+	}
+	if((size = read(fd, entries, sizeof(entries))) <= 0)
+		return (size < 0 && errno == EINTR) ? 0
+			: _probe_perror("read", 1);
+	for(i = 0; i < size / sizeof(*entries); i++)
+		_probe_publish(probe, &entries[i]);
+	/* only the latest snapshot is pushed */
+	pthread_mutex_lock(&probe->subscribers_mutex);
+	probe->push_seq = probe->seq;
+	pthread_cond_signal(&probe->push_cond);
+	pthread_mutex_unlock(&probe->subscribers_mutex);
+	return 0;
+}
+
+
+/* probe_perror */
+static int _probe_perror(char const * message, int ret)
+{
+	error_set_print(PROGNAME_PROBE, ret, "%s%s%s", message ? message : "",
+			message ? ": " : "", strerror(errno));
+	return ret;
+}
+
+
+/* probe_publish */
+static void _probe_publish(Probe * probe, ProbeHistory const * entry)
+{
+	ProbeHistory * h;
+	ProbeHistory oldest;
+	ProbeIndex * ifaces = NULL;
+	ProbeIndex * vols = NULL;
+
+	pthread_rwlock_wrlock(&probe->lock);
+	/* only the latest snapshot keeps its indexes */
+	if((h = _probe_history_get(probe, probe->seq)) != NULL)
+	{
+		ifaces = h->ifaces;
+		vols = h->vols;
+		h->ifaces = NULL;
+		h->vols = NULL;
+	}
+	/* replaces the oldest snapshot kept */
+	if(++probe->seq == 0)
+		probe->seq++;
+	h = &probe->history[probe->seq % probe->history_size];
+	oldest = *h;
+	*h = *entry;
+	pthread_rwlock_unlock(&probe->lock);
+	_probe_history_delete(&oldest);
+	if(ifaces != NULL)
+		_probe_index_delete(ifaces);
+	if(vols != NULL)
+		_probe_index_delete(vols);
+	/* only ever written from this thread */
+	if(probe->export != NULL)
+		export_publish(probe->export, entry->snapshot, probe->seq,
+				entry->timestamp);
+}
+
+
+/* probe_push */
+static int _push_call(Probe * probe, ProbeSubscriber * s,
+		Buffer * encoded);
+static int _push_on_timeout(Probe * probe);
+
+static void _probe_push(Probe * probe, uint32_t seq)
+{
+	ProbeHistory * h;
+	Buffer * encoded = NULL;
+	ProbeSubscriber * pushed;
+	size_t pushed_cnt;
+	size_t i;
+	size_t j;
+	ProbeSubscriber * s;
+
+	/* the ring may move on while pushing */
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, seq)) != NULL)
+		encoded = buffer_new(buffer_get_size(h->encoded),
+				buffer_get_data(h->encoded));
+	pthread_rwlock_unlock(&probe->lock);
+	if(encoded == NULL)
+	{
+		if(h != NULL)
+			_probe_error(1);
+		return;
+	}
+	if(probe->push_event == NULL
+			&& (probe->push_event = event_new()) == NULL)
+	{
+		buffer_delete(encoded);
+		_probe_error(1);
+		return;
+	}
+	/* pushed without the lock, the servers take it to subscribe */
+	pthread_mutex_lock(&probe->subscribers_mutex);
+	if((pushed_cnt = probe->subscribers_cnt) == 0
+			|| (pushed = malloc(sizeof(*pushed) * pushed_cnt))
+			== NULL)
+	{
+		pthread_mutex_unlock(&probe->subscribers_mutex);
+		buffer_delete(encoded);
+		if(pushed_cnt > 0)
+			_probe_perror(NULL, 1);
+		return;
+	}
+	for(i = 0; i < pushed_cnt; i++)
+	{
+		s = &probe->subscribers[i];
+		pushed[i].address = string_new(s->address);
+		pushed[i].name = string_new(s->name);
+		pushed[i].token = string_new(s->token);
+		pushed[i].appclient = s->appclient;
+		s->appclient = NULL;
+	}
+	pthread_mutex_unlock(&probe->subscribers_mutex);
+	for(i = 0; i < pushed_cnt; i++)
+		if(_push_call(probe, &pushed[i], encoded) != 0)
+		{
+			_probe_error(1);
+			if(pushed[i].appclient != NULL)
+				appclient_delete(pushed[i].appclient);
+			pushed[i].appclient = NULL;
+		}
+	pthread_mutex_lock(&probe->subscribers_mutex);
+	for(i = 0; i < pushed_cnt; i++)
+	{
+		/* unless unsubscribed meanwhile */
+		for(j = 0; j < probe->subscribers_cnt; j++)
+		{
+			s = &probe->subscribers[j];
+			if(s->appclient == NULL && pushed[i].address != NULL
+					&& pushed[i].name != NULL
+					&& string_compare(s->address,
+						pushed[i].address) == 0
+					&& string_compare(s->name,
+						pushed[i].name) == 0)
+				break;
+		}
+		if(j == probe->subscribers_cnt)
+		{
+			if(pushed[i].appclient != NULL)
+				appclient_delete(pushed[i].appclient);
+		}
+		else if(pushed[i].appclient != NULL)
+			s->appclient = pushed[i].appclient;
+		else
+			/* the subscriber has to subscribe again */
+			_probe_subscriber_delete(probe, j);
+		string_delete(pushed[i].address);
+		string_delete(pushed[i].name);
+		string_delete(pushed[i].token);
+	}
+	pthread_mutex_unlock(&probe->subscribers_mutex);
+	free(pushed);
+	buffer_delete(encoded);
+}
+
+static int _push_call(Probe * probe, ProbeSubscriber * s,
+		Buffer * encoded)
+{
+	int ret;
+	int32_t res;
+	struct timeval tv;
+
+	if(s->address == NULL || s->name == NULL || s->token == NULL)
+		return -1;
+	if(s->appclient == NULL && (s->appclient = appclient_new_event(NULL,
+					APPSERVER_DAMON_NAME, s->address,
+					probe->push_event)) == NULL)
+		return -1;
+	/* a slow subscriber only delays this push */
+	tv.tv_sec = PROBE_PUSH_TIMEOUT;
+	tv.tv_usec = 0;
+	probe->push_expired = false;
+	if(event_register_timeout(probe->push_event, &tv,
+				(EventTimeoutFunc)_push_on_timeout, probe) != 0)
+		return -1;
+	ret = appclient_call(s->appclient, (void **)&res, "push", s->name,
+			s->token, encoded);
+	if(probe->push_expired)
+		return -error_set_code(1, "%s: %s", s->address,
+				strerror(ETIMEDOUT));
+	event_unregister_timeout(probe->push_event,
+			(EventTimeoutFunc)_push_on_timeout);
+	if(ret != 0)
+		return -1;
+	return (res == 0) ? 0 : -error_set_code(1, "%s: %s", s->address,
+			"Push refused");
+}
+
+static int _push_on_timeout(Probe * probe)
+{
+	/* give up on the current push */
+	probe->push_expired = true;
+	event_loop_quit(probe->push_event);
+	return 1;
+}
+
+
+/* probe_push_start */
+static int _probe_push_start(Probe * probe)
+{
+	/* nothing to push to otherwise */
+	if(probe->pushes_cnt == 0)
+		return 0;
+	probe->push_seq = 0;
+	probe->push_quit = false;
+	if((errno = pthread_create(&probe->push_thread, NULL,
+					_probe_push_thread, probe)) != 0)
+		return _probe_perror("pthread_create", 1);
+	return 0;
+}
+
+
+/* probe_push_stop */
+static void _probe_push_stop(Probe * probe)
+{
+	if(probe->pushes_cnt == 0)
+		return;
+	/* after the push in progress, if any */
+	pthread_mutex_lock(&probe->subscribers_mutex);
+	probe->push_quit = true;
+	pthread_cond_signal(&probe->push_cond);
+	pthread_mutex_unlock(&probe->subscribers_mutex);
+	pthread_join(probe->push_thread, NULL);
+}
+
+
+/* probe_push_thread */
+static void * _probe_push_thread(void * data)
+{
+	Probe * probe = data;
+	uint32_t seq = 0;
+
+	pthread_mutex_lock(&probe->subscribers_mutex);
+	for(;;)
+	{
+		while(!probe->push_quit && probe->push_seq == seq)
+			pthread_cond_wait(&probe->push_cond,
+					&probe->subscribers_mutex);
+		if(probe->push_quit)
+			break;
+		/* skipping the snapshots collected meanwhile, if any */
+		seq = probe->push_seq;
+		pthread_mutex_unlock(&probe->subscribers_mutex);
+		_probe_push(probe, seq);
+		pthread_mutex_lock(&probe->subscribers_mutex);
+	}
+	pthread_mutex_unlock(&probe->subscribers_mutex);
+	return NULL;
+}
+
+
+/* probe_serve */
+static int _serve_on_timeout(ProbeServer * server);
+static void * _serve_thread(void * data);
+
+static int _probe_serve(Probe * probe, AppServerOptions options,
+		String const ** names, size_t names_cnt)
+{
+	ProbeServer * server;
+	struct timeval tv;
+
+	if((probe->servers = calloc(names_cnt, sizeof(*probe->servers)))
+			== NULL)
+		return -_probe_perror(NULL, 1);
+	/* every server runs its own loop, sharing the snapshots; libApp binds
+	 * every name once, so the clients of a same name are served in turn
+	 * and concurrency comes from listening to several names */
+	for(; probe->servers_cnt < names_cnt; probe->servers_cnt++)
+	{
+		server = &probe->servers[probe->servers_cnt];
+		server->probe = probe;
+		server->name = names[probe->servers_cnt];
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if((server->event = event_new()) == NULL
+				|| (server->appserver = appserver_new_event(
+						probe, (probe->servers_cnt == 0)
+						? options : 0,
+						APPSERVER_PROBE_NAME,
+						server->name, server->event))
+				== NULL
+				|| event_register_timeout(server->event, &tv,
+					(EventTimeoutFunc)_serve_on_timeout,
+					server) != 0)
+			break;
+		if((errno = pthread_create(&server->thread, NULL,
+						_serve_thread, server)) != 0)
+		{
+			_probe_perror("pthread_create", 1);
+			break;
+		}
+	}
+	if(probe->servers_cnt == names_cnt)
+		return 0;
+	/* the server being set up is not running yet */
+	server = &probe->servers[probe->servers_cnt];
+	if(server->appserver != NULL)
+		appserver_delete(server->appserver);
+	if(server->event != NULL)
+		event_delete(server->event);
+	_probe_serve_stop(probe);
+	return -1;
+}
+
+static int _serve_on_timeout(ProbeServer * server)
+{
+	Probe * probe = server->probe;
+	bool quit;
+
+	pthread_mutex_lock(&probe->mutex);
+	quit = probe->quit;
+	pthread_mutex_unlock(&probe->mutex);
+	if(!quit)
+		return 0;
+	event_loop_quit(server->event);
+	return 1;
+}
+
+static void * _serve_thread(void * data)
+{
+	ProbeServer * server = data;
+
+	event_loop(server->event);
+	return NULL;
+}
+
+
+/* probe_serve_stop */
+static void _probe_serve_stop(Probe * probe)
+{
+	ProbeServer * server;
+
+	/* whether collecting or not, the servers notice within a second */
+	pthread_mutex_lock(&probe->mutex);
+	probe->quit = true;
+	pthread_mutex_unlock(&probe->mutex);
+	for(; probe->servers_cnt > 0; probe->servers_cnt--)
+	{
+		server = &probe->servers[probe->servers_cnt - 1];
+		pthread_join(server->thread, NULL);
+		appserver_delete(server->appserver);
+		event_delete(server->event);
+	}
+	free(probe->servers);
+	probe->servers = NULL;
+}
+
+
+/* probe_snapshot */
+static Snapshot * _probe_snapshot(Probe * probe)
+{
+	Snapshot * snapshot;
+	unsigned int i;
+
+	if((snapshot = snapshot_new()) == NULL)
+		return NULL;
+	snapshot->uptime = probe->sysinfo.uptime;
+	snapshot->load[0] = probe->sysinfo.loads[0];
+	snapshot->load[1] = probe->sysinfo.loads[1];
+	snapshot->load[2] = probe->sysinfo.loads[2];
+	snapshot->ram[0] = probe->sysinfo.totalram;
+	snapshot->ram[1] = probe->sysinfo.freeram;
+	snapshot->ram[2] = probe->sysinfo.sharedram;
+	snapshot->ram[3] = probe->sysinfo.bufferram;
+	snapshot->swap[0] = probe->sysinfo.totalswap;
+	snapshot->swap[1] = probe->sysinfo.freeswap;
+	snapshot->procs = probe->sysinfo.procs;
+	snapshot->users = probe->users;
+	if(snapshot_set_interfaces_count(snapshot, probe->ifinfo_cnt) != 0
+			|| snapshot_set_volumes_count(snapshot,
+				probe->volinfo_cnt) != 0)
+	{
+		snapshot_delete(snapshot);
+		return NULL;
+	}
+	for(i = 0; i < probe->ifinfo_cnt; i++)
+	{
+		if(snapshot_set_interface_name(snapshot, i,
+					probe->ifinfo[i].name) != 0)
+		{
+			snapshot_delete(snapshot);
+			return NULL;
+		}
+		snapshot->ifaces[i].rxbytes = probe->ifinfo[i].ibytes;
+		snapshot->ifaces[i].txbytes = probe->ifinfo[i].obytes;
+	}
+	for(i = 0; i < probe->volinfo_cnt; i++)
+	{
+		if(snapshot_set_volume_name(snapshot, i,
+					probe->volinfo[i].name) != 0)
+		{
+			snapshot_delete(snapshot);
+			return NULL;
+		}
+		snapshot->vols[i].total = (uint64_t)probe->volinfo[i].total
+			* (probe->volinfo[i].block_size / 1024);
+		snapshot->vols[i].free = (uint64_t)probe->volinfo[i].free
+			* (probe->volinfo[i].block_size / 1024);
+	}
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u interfaces, %u volumes\n", __func__,
+			probe->ifinfo_cnt, probe->volinfo_cnt);
+#endif
+	return snapshot;
+}
+
+
+/* probe_snapshot_get */
+static Snapshot * _probe_snapshot_get(Probe * probe, uint32_t seq)
+{
+	ProbeHistory * h;
+
+	return ((h = _probe_history_get(probe, seq)) != NULL) ? h->snapshot
+		: NULL;
+}
+
+
+/* probe_subscriber_delete */
+static void _probe_subscriber_delete(Probe * probe, size_t i)
+{
+	ProbeSubscriber * s = &probe->subscribers[i];
+
+	if(s->appclient != NULL)
+		appclient_delete(s->appclient);
+	string_delete(s->address);
+	string_delete(s->name);
+	string_delete(s->token);
+	memmove(s, &s[1], sizeof(*s) * (probe->subscribers_cnt - i - 1));
+	probe->subscribers_cnt--;
+}
+
+
+/* probe_thread */
+static void * _probe_thread(void * data)
+{
+	Probe * probe = data;
+	struct timespec ts;
+	time_t now;
+	ProbeHistory entry;
+
+	ts.tv_sec = time(NULL);
+	ts.tv_nsec = 0;
+	pthread_mutex_lock(&probe->mutex);
+	for(;;)
+	{
+		/* keep to the interval however long collecting takes */
+		ts.tv_sec += probe->refresh;
+		if((now = time(NULL)) > ts.tv_sec)
+			ts.tv_sec = now;
+		while(!probe->quit && pthread_cond_timedwait(&probe->cond,
+					&probe->mutex, &ts) != ETIMEDOUT);
+		if(probe->quit)
+			break;
+		pthread_mutex_unlock(&probe->mutex);
+		/* the handlers keep serving the previous snapshot meanwhile */
+		if(_probe_collect(probe, &entry) == 0
+				&& write(probe->fds[1], &entry, sizeof(entry))
+				!= sizeof(entry))
+		{
+			_probe_perror("write", 1);
+			_probe_history_delete(&entry);
+		}
+		pthread_mutex_lock(&probe->mutex);
+	}
+	pthread_mutex_unlock(&probe->mutex);
+	return NULL;
+}
+
+
+/* public */
+/* functions */
+/* AppInterface */
+/* Probe_uptime */
+uint32_t Probe_uptime(Probe * probe, AppServerClient * asc)
+{
+	Snapshot * snapshot;
+	uint32_t ret = 0;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((snapshot = _probe_snapshot_get(probe, probe->seq)) != NULL)
+		ret = snapshot->uptime;
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u\n", __func__, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_load */
+int32_t Probe_load(Probe * probe, AppServerClient * asc, uint32_t * load1,
+		uint32_t * load5, uint32_t * load15)
+{
+	Snapshot * snapshot;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((snapshot = _probe_snapshot_get(probe, probe->seq)) != NULL)
+	{
+		*load1 = snapshot->load[0];
+		*load5 = snapshot->load[1];
+		*load15 = snapshot->load[2];
+	}
+	pthread_rwlock_unlock(&probe->lock);
+	if(snapshot == NULL)
+		return -1;
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u %u %u\n", __func__, *load1, *load5,
+			*load15);
+#endif
+	return 0;
+}
+
+
+/* Probe_ram */
+int32_t Probe_ram(Probe * probe, AppServerClient * asc, uint32_t * total,
+		uint32_t * free, uint32_t * shared, uint32_t * buffer)
+{
+	Snapshot * snapshot;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((snapshot = _probe_snapshot_get(probe, probe->seq)) != NULL)
+	{
+		*total = snapshot->ram[0];
+		*free = snapshot->ram[1];
+		*shared = snapshot->ram[2];
+		*buffer = snapshot->ram[3];
+	}
+	pthread_rwlock_unlock(&probe->lock);
+	if(snapshot == NULL)
+		return -1;
+#if defined(DEBUG)
+	fprintf(stderr, "%s() total %u, free %u, shared %u, buffered %u\n",
+			__func__, *total, *free, *shared, *buffer);
+#endif
+	return 0;
+}
+
+
+/* Probe_swap */
+int32_t Probe_swap(Probe * probe, AppServerClient * asc, uint32_t * total,
+		uint32_t * free)
+{
+	Snapshot * snapshot;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((snapshot = _probe_snapshot_get(probe, probe->seq)) != NULL)
+	{
+		*total = snapshot->swap[0];
+		*free = snapshot->swap[1];
+	}
+	pthread_rwlock_unlock(&probe->lock);
+	if(snapshot == NULL)
+		return -1;
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u/%u\n", __func__, *total - *free, *total);
+#endif
+	return 0;
+}
+
+
+/* Probe_procs */
+uint32_t Probe_procs(Probe * probe, AppServerClient * asc)
+{
+	Snapshot * snapshot;
+	uint32_t ret = 0;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((snapshot = _probe_snapshot_get(probe, probe->seq)) != NULL)
+		ret = snapshot->procs;
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u\n", __func__, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_users */
+uint32_t Probe_users(Probe * probe, AppServerClient * asc)
+{
+	Snapshot * snapshot;
+	uint32_t ret = 0;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((snapshot = _probe_snapshot_get(probe, probe->seq)) != NULL)
+		ret = snapshot->users;
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u\n", __func__, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_history */
+int32_t Probe_history(Probe * probe, AppServerClient * asc, uint32_t since,
+		uint32_t * seq, Buffer * buffer)
+{
+	Snapshot * base;
+	uint32_t s;
+	size_t cnt = 0;
+	ProbeHistory * h;
+	int32_t ret = 0;
+	(void) asc;
+
+	if(buffer_set_size(buffer, 0) != 0)
+		return -1;
+	pthread_rwlock_rdlock(&probe->lock);
+	*seq = probe->seq;
+	/* everything kept when the client is too far behind */
+	if((base = _probe_snapshot_get(probe, since)) != NULL)
+		s = since + 1;
+	else
+		s = probe->seq - probe->history_size + 1;
+	for(; s != probe->seq + 1 && cnt < PROBE_HISTORY_BATCH; s++)
+	{
+		h = &probe->history[s % probe->history_size];
+		if(s == 0 || h->snapshot == NULL)
+			continue;
+		/* every entry as a delta over the previous one */
+		if((ret = snapshot_history_append(buffer, s, h->timestamp,
+						h->snapshot, base)) != 0)
+			break;
+		base = h->snapshot;
+		/* where the next batch starts from */
+		*seq = s;
+		cnt++;
+	}
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u to %u, %lu entries\n", __func__, since,
+			*seq, (unsigned long)cnt);
+#endif
+	return ret;
+}
+
+
+/* Probe_ifrxbytes */
+uint32_t Probe_ifrxbytes(Probe * probe, AppServerClient * asc,
+		String const * dev)
+{
+	ProbeHistory * h;
+	size_t pos;
+	uint32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL
+			&& _probe_index_find_interface(h->ifaces,
+				h->snapshot, dev, &pos) == 0)
+		ret = h->snapshot->ifaces[pos].rxbytes;
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %s %u\n", __func__, dev, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_iftxbytes */
+uint32_t Probe_iftxbytes(Probe * probe, AppServerClient * asc,
+		String const * dev)
+{
+	ProbeHistory * h;
+	size_t pos;
+	uint32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL
+			&& _probe_index_find_interface(h->ifaces,
+				h->snapshot, dev, &pos) == 0)
+		ret = h->snapshot->ifaces[pos].txbytes;
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %s %u\n", __func__, dev, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_interface_id */
+int32_t Probe_interface_id(Probe * probe, AppServerClient * asc,
+		String const * interface)
+{
+	ProbeHistory * h;
+	size_t pos;
+	int32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL
+			&& _probe_index_find_interface(h->ifaces,
+				h->snapshot, interface, &pos) == 0)
+		ret = h->ifaces->ids[pos];
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %s %d\n", __func__, interface, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_interface_stats */
+int32_t Probe_interface_stats(Probe * probe, AppServerClient * asc,
+		uint32_t id, uint32_t * rxbytes, uint32_t * txbytes)
+{
+	ProbeHistory * h;
+	size_t pos;
+	int32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL
+			&& _probe_index_find_id(h->ifaces, id, &pos) == 0)
+	{
+		*rxbytes = h->snapshot->ifaces[pos].rxbytes;
+		*txbytes = h->snapshot->ifaces[pos].txbytes;
+		ret = 0;
+	}
+	pthread_rwlock_unlock(&probe->lock);
+	return ret;
+}
+
+
+/* Probe_list_interfaces */
+static int32_t _list_names(Probe * probe, bool volumes, uint32_t since,
+		uint32_t * generation, Buffer * buffer);
+
+int32_t Probe_list_interfaces(Probe * probe, AppServerClient * asc,
+		uint32_t since, uint32_t * generation, Buffer * buffer)
+{
+	(void) asc;
+
+	return _list_names(probe, false, since, generation, buffer);
+}
+
+static int32_t _list_names(Probe * probe, bool volumes, uint32_t since,
+		uint32_t * generation, Buffer * buffer)
+{
+	ProbeHistory * h;
+	ProbeIndex * index;
+	char const * name;
+	size_t len = 0;
+	size_t i;
+	int32_t ret = 0;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) == NULL)
+	{
+		pthread_rwlock_unlock(&probe->lock);
+		return -1;
+	}
+	index = volumes ? h->vols : h->ifaces;
+	*generation = index->generation;
+	/* every distinct name, terminated, unless already known */
+	for(i = 0; since != index->generation && i < index->cnt; i++)
+		if(_probe_index_is_first(index, i))
+			len += strlen(volumes ? h->snapshot->vols[i].name
+					: h->snapshot->ifaces[i].name) + 1;
+	if(buffer_set_size(buffer, len) != 0)
+		ret = -1;
+	for(len = 0, i = 0; ret == 0 && since != index->generation
+			&& i < index->cnt; i++)
+	{
+		if(!_probe_index_is_first(index, i))
+			continue;
+		name = volumes ? h->snapshot->vols[i].name
+			: h->snapshot->ifaces[i].name;
+		memcpy(buffer_get_data(buffer) + len, name, strlen(name) + 1);
+		len += strlen(name) + 1;
+	}
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u to %u\n", __func__, since, *generation);
+#endif
+	return ret;
+}
+
+
+/* Probe_list_volumes */
+int32_t Probe_list_volumes(Probe * probe, AppServerClient * asc,
+		uint32_t since, uint32_t * generation, Buffer * buffer)
+{
+	(void) asc;
+
+	return _list_names(probe, true, since, generation, buffer);
+}
+
+
+/* Probe_voltotal */
+uint32_t Probe_voltotal(Probe * probe, AppServerClient * asc,
+		String const * volume)
+{
+	ProbeHistory * h;
+	size_t pos;
+	uint32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL
+			&& _probe_index_find_volume(h->vols,
+				h->snapshot, volume, &pos) == 0)
+		ret = h->snapshot->vols[pos].total;
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %s %u\n", __func__, volume, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_volfree */
+uint32_t Probe_volfree(Probe * probe, AppServerClient * asc,
+		String const * volume)
+{
+	ProbeHistory * h;
+	size_t pos;
+	uint32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL
+			&& _probe_index_find_volume(h->vols,
+				h->snapshot, volume, &pos) == 0)
+		ret = h->snapshot->vols[pos].free;
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %s %u\n", __func__, volume, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_volume_id */
+int32_t Probe_volume_id(Probe * probe, AppServerClient * asc,
+		String const * volume)
+{
+	ProbeHistory * h;
+	size_t pos;
+	int32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL
+			&& _probe_index_find_volume(h->vols,
+				h->snapshot, volume, &pos) == 0)
+		ret = h->vols->ids[pos];
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %s %d\n", __func__, volume, ret);
+#endif
+	return ret;
+}
+
+
+/* Probe_volume_stats */
+int32_t Probe_volume_stats(Probe * probe, AppServerClient * asc,
+		uint32_t id, uint32_t * total, uint32_t * free)
+{
+	ProbeHistory * h;
+	size_t pos;
+	int32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL
+			&& _probe_index_find_id(h->vols, id, &pos) == 0)
+	{
+		*total = h->snapshot->vols[pos].total;
+		*free = h->snapshot->vols[pos].free;
+		ret = 0;
+	}
+	pthread_rwlock_unlock(&probe->lock);
+	return ret;
+}
+
+
+/* Probe_snapshot */
+int32_t Probe_snapshot(Probe * probe, AppServerClient * asc, Buffer * buffer)
+{
+	ProbeHistory * h;
+	int32_t ret = -1;
+	(void) asc;
+
+	/* as encoded when collected */
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL)
+		ret = buffer_set(buffer, buffer_get_size(h->encoded),
+				buffer_get_data(h->encoded));
+	pthread_rwlock_unlock(&probe->lock);
+	return ret;
+}
+
+
+/* Probe_snapshot_delta */
+int32_t Probe_snapshot_delta(Probe * probe, AppServerClient * asc,
+		uint32_t since, uint32_t * seq, Buffer * buffer)
+{
+	ProbeHistory * h;
+	Snapshot * base;
+	int32_t ret = -1;
+	(void) asc;
+
+	pthread_rwlock_rdlock(&probe->lock);
+	if((h = _probe_history_get(probe, probe->seq)) != NULL)
+	{
+		*seq = probe->seq;
+		/* a full snapshot when the one given is too old */
+		if((base = _probe_snapshot_get(probe, since)) == NULL)
+			ret = buffer_set(buffer, buffer_get_size(h->encoded),
+					buffer_get_data(h->encoded));
+		else
+			ret = snapshot_encode_delta(h->snapshot, base, buffer);
+	}
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u to %u\n", __func__, since, *seq);
+#endif
+	return ret;
+}
+
+
+/* Probe_summary */
+int32_t Probe_summary(Probe * probe, AppServerClient * asc, uint32_t since,
+		uint32_t * seq, Buffer * buffer)
+{
+	SnapshotSummary summary;
+	uint32_t s;
+	ProbeHistory * h;
+	(void) asc;
+
+	snapshot_summary_reset(&summary);
+	pthread_rwlock_rdlock(&probe->lock);
+	*seq = probe->seq;
+	/* every client has its own window, like with the history */
+	if(_probe_snapshot_get(probe, since) != NULL)
+		s = since + 1;
+	else
+		s = probe->seq - probe->history_size + 1;
+	for(; s != probe->seq + 1; s++)
+	{
+		h = &probe->history[s % probe->history_size];
+		if(s != 0 && h->snapshot != NULL)
+			snapshot_summary_update(&summary, h->snapshot);
+	}
+	pthread_rwlock_unlock(&probe->lock);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %u to %u, %u snapshots\n", __func__, since,
+			*seq, summary.count);
+#endif
+	return snapshot_summary_encode(&summary, buffer);
+}
+
+
+/* Probe_subscribe */
+int32_t Probe_subscribe(Probe * probe, AppServerClient * asc,
+		String const * address, String const * name,
+		String const * token)
+{
+	size_t i;
+	ProbeSubscriber * s;
+	String * t;
+	(void) asc;
+
+	/* only pushing to the addresses given on the command line */
+	for(i = 0; i < probe->pushes_cnt; i++)
+		if(string_compare(probe->pushes[i], address) == 0)
+			break;
+	if(i == probe->pushes_cnt)
+		return -1;
+	pthread_mutex_lock(&probe->subscribers_mutex);
+	for(i = 0; i < probe->subscribers_cnt; i++)
+		if(string_compare(probe->subscribers[i].address, address) == 0
+				&& string_compare(probe->subscribers[i].name,
+					name) == 0)
+		{
+			/* the token may have changed after a restart */
+			if((t = string_new(token)) != NULL)
+			{
+				string_delete(probe->subscribers[i].token);
+				probe->subscribers[i].token = t;
+			}
+			pthread_mutex_unlock(&probe->subscribers_mutex);
+			return (t != NULL) ? 0 : -_probe_error(1);
+		}
+	if(probe->subscribers_cnt >= PROBE_SUBSCRIBERS_MAX)
+	{
+		pthread_mutex_unlock(&probe->subscribers_mutex);
+		return -1;
+	}
+	if((s = realloc(probe->subscribers, sizeof(*s)
+					* (probe->subscribers_cnt + 1))) == NULL)
+	{
+		pthread_mutex_unlock(&probe->subscribers_mutex);
+		return -_probe_perror(NULL, 1);
+	}
+	probe->subscribers = s;
+	s = &probe->subscribers[probe->subscribers_cnt];
+	s->address = string_new(address);
+	s->name = string_new(name);
+	s->token = string_new(token);
+	/* connected on the first push */
+	s->appclient = NULL;
+	if(s->address == NULL || s->name == NULL || s->token == NULL)
+	{
+		pthread_mutex_unlock(&probe->subscribers_mutex);
+		string_delete(s->address);
+		string_delete(s->name);
+		string_delete(s->token);
+		return -_probe_error(1);
+	}
+	probe->subscribers_cnt++;
+	pthread_mutex_unlock(&probe->subscribers_mutex);
+#if defined(DEBUG)
+	fprintf(stderr, "%s() %s %s\n", __func__, address, name);
+#endif
+	return 0;
+}
+
+
+/* Probe_unsubscribe */
+int32_t Probe_unsubscribe(Probe * probe, AppServerClient * asc,
+		String const * address, String const * name)
+{
+	int32_t ret = -1;
+	size_t i;
+	(void) asc;
+
+	pthread_mutex_lock(&probe->subscribers_mutex);
+	for(i = 0; i < probe->subscribers_cnt; i++)
+		if(string_compare(probe->subscribers[i].address, address) == 0
+				&& string_compare(probe->subscribers[i].name,
+					name) == 0)
+		{
+			_probe_subscriber_delete(probe, i);
+			ret = 0;
+			break;
+		}
+	pthread_mutex_unlock(&probe->subscribers_mutex);
+	return ret;
+}
+
+
+/* usage */
+static int _usage(void)
+{
+	fputs("Usage: " PROGNAME_PROBE " [-R][-d depth][-i interval]"
+" [-l name...][-p address...][-s name]\n"
+"  -R\tRegister with the session\n"
+"  -d\tNumber of snapshots kept in the history (default: 360)\n"
+"  -i\tInterval between snapshots, in seconds (default: 10)\n"
+"  -l\tListen to this name, from a thread of its own (repeatable)\n"
+"  -p\tAccept subscriptions pushing to this address (repeatable)\n"
+"  -s\tPublish the snapshots to this shared memory object\n",
+			stderr);
+	return 1;
+}
+
+
+/* main */
+int main(int argc, char * argv[])
+{
+	int o;
+	AppServerOptions options = 0;
+	unsigned int refresh = PROBE_REFRESH;
+	size_t depth = PROBE_HISTORY_DEPTH;
+	String const ** names;
+	size_t names_cnt = 0;
+	String const ** pushes;
+	size_t pushes_cnt = 0;
+	String const * shm = NULL;
+	char * p;
+	int ret;
+
+	/* at most one name or address per argument */
+	if((names = malloc(sizeof(*names) * argc * 2)) == NULL)
+		return _probe_perror(NULL, 2);
+	pushes = &names[argc];
+	while((o = getopt(argc, argv, "Rd:i:l:p:s:")) != -1)
+		switch(o)
+		{
+			case 'R':
+				options = ASO_REGISTER;
+				break;
+			case 'd':
+				depth = strtoul(optarg, &p, 10);
+				if(optarg[0] == '\0' || *p != '\0'
+						|| depth == 0)
+				{
+					free(names);
+					return _usage();
+				}
+				break;
+			case 'i':
+				refresh = strtoul(optarg, &p, 10);
+				if(optarg[0] == '\0' || *p != '\0'
+						|| refresh == 0)
+				{
+					free(names);
+					return _usage();
+				}
+				break;
+			case 'l':
+				names[names_cnt++] = optarg;
+				break;
+			case 'p':
+				pushes[pushes_cnt++] = optarg;
+				break;
+			case 's':
+				shm = optarg;
+				break;
+			default:
+				free(names);
+				return _usage();
+		}
+	if(optind != argc)
+	{
+		free(names);
+		return _usage();
+	}
+	ret = (_probe(options, refresh, depth, names, names_cnt, pushes,
+				pushes_cnt, shm) == 0) ? 0 : 2;
+	free(names);
+	return ret;
 }
@@ -0,0 +1,527 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* The files have a fixed size and are mapped in memory, in host byte order:
+ * - the header
+ * - the primary data point being computed, for every source
+ * - the description of every archive
+ * - the consolidated data point being computed, for every archive and source
+ * - the rows of every archive, with one value per source
+ * Like with rrdtool(1), unknown values are stored as NaN. */
+
+
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <System.h>
+#include "ring.h"
+
+
+/* Ring */
+/* private */
+/* types */
+typedef struct _RingHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t step;
+	uint32_t heartbeat;
+	uint32_t sources_cnt;
+	uint32_t archives_cnt;
+	uint32_t padding;
+	int64_t last;				/* time of the last update */
+} RingHeader;
+
+typedef struct _RingSource
+{
+	double pdp;				/* last primary data point */
+	double sum;				/* value times seconds */
+	uint32_t known;				/* seconds */
+	uint32_t padding;
+} RingSource;
+
+typedef struct _RingFileArchive
+{
+	uint32_t function;
+	uint32_t steps;
+	uint32_t rows;
+	uint32_t row;				/* last row written */
+	double xff;
+} RingFileArchive;
+
+typedef struct _RingPoint
+{
+	double value;
+	uint32_t known;				/* steps */
+	uint32_t unknown;			/* steps */
+} RingPoint;
+
+struct _Ring
+{
+	String * filename;
+	void * map;
+	size_t size;
+
+	RingHeader * header;
+	RingSource * sources;
+	RingFileArchive * archives;
+	RingPoint * points;
+	double ** rows;
+};
+
+
+/* constants */
+#define RING_MAGIC		"DaMonRng"
+#define RING_VERSION		1
+
+
+/* prototypes */
+static size_t _ring_get_size(size_t sources_cnt, RingArchive const * archives,
+		size_t archives_cnt);
+
+static void _ring_map(Ring * ring);
+static void _ring_reset(Ring * ring);
+static void _ring_step(Ring * ring, int64_t timestamp);
+
+
+/* public */
+/* functions */
+/* ring_create */
+int ring_create(char const * filename, unsigned int step,
+		unsigned int heartbeat, time_t start, size_t sources_cnt,
+		RingArchive const * archives, size_t archives_cnt)
+{
+	int ret = 0;
+	String * tmp;
+	int fd;
+	Ring ring;
+	size_t i;
+
+	if(step == 0 || sources_cnt == 0 || archives_cnt == 0)
+		return error_set_code(-EINVAL, "%s: %s", filename,
+				strerror(EINVAL));
+	for(i = 0; i < archives_cnt; i++)
+		if(archives[i].steps == 0 || archives[i].rows == 0)
+			return error_set_code(-EINVAL, "%s: %s", filename,
+					strerror(EINVAL));
+	/* create the file aside and rename it once complete */
+	if((tmp = string_new_append(filename, ".XXXXXX", NULL)) == NULL)
+		return -1;
+	if((fd = mkstemp(tmp)) < 0)
+	{
+		error_set_code(-errno, "%s: %s", tmp, strerror(errno));
+		string_delete(tmp);
+		return -1;
+	}
+	ring.size = _ring_get_size(sources_cnt, archives, archives_cnt);
+	if(fchmod(fd, 0644) != 0 || ftruncate(fd, ring.size) != 0
+			|| (ring.map = mmap(NULL, ring.size,
+					PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+					0)) == MAP_FAILED)
+	{
+		ret = error_set_code(-errno, "%s: %s", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		string_delete(tmp);
+		return ret;
+	}
+	close(fd);
+	memset(ring.map, 0, ring.size);
+	ring.header = ring.map;
+	memcpy(ring.header->magic, RING_MAGIC, sizeof(ring.header->magic));
+	ring.header->version = RING_VERSION;
+	ring.header->step = step;
+	ring.header->heartbeat = heartbeat;
+	ring.header->sources_cnt = sources_cnt;
+	ring.header->archives_cnt = archives_cnt;
+	ring.header->last = start;
+	ring.rows = NULL;
+	_ring_map(&ring);
+	for(i = 0; i < archives_cnt; i++)
+	{
+		ring.archives[i].function = archives[i].function;
+		ring.archives[i].steps = archives[i].steps;
+		ring.archives[i].rows = archives[i].rows;
+		ring.archives[i].xff = archives[i].xff;
+	}
+	if((ring.rows = malloc(sizeof(*ring.rows) * archives_cnt)) == NULL)
+		ret = error_set_code(-errno, "%s", strerror(errno));
+	else
+	{
+		_ring_map(&ring);
+		_ring_reset(&ring);
+		free(ring.rows);
+	}
+	munmap(ring.map, ring.size);
+	if(ret == 0 && rename(tmp, filename) != 0)
+		ret = error_set_code(-errno, "%s: %s", filename,
+				strerror(errno));
+	if(ret != 0)
+		unlink(tmp);
+	string_delete(tmp);
+	return ret;
+}
+
+
+/* ring_open */
+static int _open_check(Ring * ring);
+
+Ring * ring_open(char const * filename, bool writable)
+{
+	Ring * ring;
+	int fd;
+	struct stat st;
+	RingHeader header;
+
+	if((fd = open(filename, writable ? O_RDWR : O_RDONLY)) < 0)
+	{
+		error_set_code(-errno, "%s: %s", filename, strerror(errno));
+		return NULL;
+	}
+	if(fstat(fd, &st) != 0
+			|| read(fd, &header, sizeof(header)) != sizeof(header))
+	{
+		error_set_code(-errno, "%s: %s", filename, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if(memcmp(header.magic, RING_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != RING_VERSION
+			|| header.step == 0 || header.sources_cnt == 0
+			|| header.archives_cnt == 0
+			|| (size_t)st.st_size < _ring_get_size(
+				header.sources_cnt, NULL, header.archives_cnt))
+	{
+		error_set_code(1, "%s: %s", filename,
+				"Not a database in the native format");
+		close(fd);
+		return NULL;
+	}
+	if((ring = object_new(sizeof(*ring))) == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+	ring->filename = string_new(filename);
+	ring->rows = malloc(sizeof(*ring->rows) * header.archives_cnt);
+	ring->size = st.st_size;
+	if(ring->filename == NULL || ring->rows == NULL
+			|| (ring->map = mmap(NULL, ring->size, writable
+					? PROT_READ | PROT_WRITE : PROT_READ,
+					MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		error_set_code(-errno, "%s: %s", filename, strerror(errno));
+		close(fd);
+		free(ring->rows);
+		string_delete(ring->filename);
+		object_delete(ring);
+		return NULL;
+	}
+	close(fd);
+	ring->header = ring->map;
+	if(_open_check(ring) != 0)
+	{
+		ring_close(ring);
+		return NULL;
+	}
+	_ring_map(ring);
+	return ring;
+}
+
+static int _open_check(Ring * ring)
+{
+	RingHeader * header = ring->header;
+	RingFileArchive * archives;
+	size_t size;
+	uint32_t i;
+
+	/* the rows of every archive must fit exactly */
+	archives = (RingFileArchive *)((RingSource *)(header + 1)
+			+ header->sources_cnt);
+	size = _ring_get_size(header->sources_cnt, NULL,
+			header->archives_cnt);
+	for(i = 0; i < header->archives_cnt; i++)
+	{
+		if(archives[i].steps == 0 || archives[i].rows == 0
+				|| archives[i].row >= archives[i].rows)
+			break;
+		size += sizeof(double) * archives[i].rows
+			* header->sources_cnt;
+	}
+	if(i != header->archives_cnt || size != ring->size)
+		return error_set_code(1, "%s: %s", ring->filename,
+				"Corrupted database");
+	return 0;
+}
+
+
+/* ring_close */
+void ring_close(Ring * ring)
+{
+	munmap(ring->map, ring->size);
+	free(ring->rows);
+	string_delete(ring->filename);
+	object_delete(ring);
+}
+
+
+/* accessors */
+/* ring_get_filename */
+char const * ring_get_filename(Ring const * ring)
+{
+	return ring->filename;
+}
+
+
+/* useful */
+/* ring_dump */
+int ring_dump(Ring const * ring, FILE * fp)
+{
+	RingHeader const * header = ring->header;
+	RingFileArchive const * archive;
+	double const * row;
+	int64_t duration;
+	int64_t t;
+	uint32_t i;
+	uint32_t j;
+	uint32_t k;
+
+	fprintf(fp, "# %s: step %u, heartbeat %u, last %lld\n",
+			ring->filename, header->step, header->heartbeat,
+			(long long)header->last);
+	for(i = 0; i < header->archives_cnt; i++)
+	{
+		archive = &ring->archives[i];
+		fprintf(fp, "# archive %u: %s, xff %g, steps %u, rows %u\n", i,
+				(archive->function == RINGFUNCTION_MAX)
+				? "MAX" : "AVERAGE", archive->xff,
+				archive->steps, archive->rows);
+		/* the last row written is for the last boundary crossed */
+		duration = (int64_t)header->step * archive->steps;
+		t = header->last / duration * duration
+			- duration * (archive->rows - 1);
+		for(j = 1; j <= archive->rows; j++, t += duration)
+		{
+			row = &ring->rows[i][((archive->row + j) % archive->rows)
+				* header->sources_cnt];
+			fprintf(fp, "%lld:", (long long)t);
+			for(k = 0; k < header->sources_cnt; k++)
+				if(isnan(row[k]))
+					fputs(" U", fp);
+				else
+					fprintf(fp, " %g", row[k]);
+			fputc('\n', fp);
+		}
+	}
+	return ferror(fp) ? error_set_code(-errno, "%s", strerror(errno))
+		: 0;
+}
+
+
+/* ring_update */
+int ring_update(Ring * ring, time_t timestamp, double const * values,
+		size_t values_cnt)
+{
+	RingHeader * header = ring->header;
+	int64_t t = timestamp;
+	int64_t t0;
+	int64_t t1;
+	int64_t boundary;
+	int64_t limit = 0;
+	bool known;
+	uint32_t i;
+
+	if(values_cnt != header->sources_cnt)
+		return error_set_code(-EINVAL, "%s: %s", ring->filename,
+				"Invalid number of values");
+	if(t <= header->last)
+		return error_set_code(1, "%s: %lld: %s", ring->filename,
+				(long long)t, "Illegal update time");
+	/* past the longest archive, everything is unknown anyway */
+	for(i = 0; i < header->archives_cnt; i++)
+		if((int64_t)ring->archives[i].steps * ring->archives[i].rows
+				> limit)
+			limit = (int64_t)ring->archives[i].steps
+				* ring->archives[i].rows;
+	if((t - header->last) / header->step > limit)
+	{
+		_ring_reset(ring);
+		header->last = t;
+		return 0;
+	}
+	/* the values apply to the whole interval since the last update */
+	known = (t - header->last <= header->heartbeat);
+	for(i = 0; known && i < values_cnt; i++)
+		if(isnan(values[i]) || values[i] < 0.0)
+			known = false;
+	for(t0 = header->last; t0 < t; t0 = t1)
+	{
+		boundary = (t0 / header->step + 1) * header->step;
+		t1 = (boundary < t) ? boundary : t;
+		if(known)
+			for(i = 0; i < values_cnt; i++)
+			{
+				ring->sources[i].sum += values[i] * (t1 - t0);
+				ring->sources[i].known += t1 - t0;
+			}
+		if(t1 == boundary)
+			_ring_step(ring, boundary);
+	}
+	header->last = t;
+	return 0;
+}
+
+
+/* private */
+/* functions */
+/* ring_get_size */
+static size_t _ring_get_size(size_t sources_cnt, RingArchive const * archives,
+		size_t archives_cnt)
+{
+	size_t ret;
+	size_t i;
+
+	ret = sizeof(RingHeader) + sizeof(RingSource) * sources_cnt
+		+ (sizeof(RingFileArchive) + sizeof(RingPoint) * sources_cnt)
+		* archives_cnt;
+	for(i = 0; archives != NULL && i < archives_cnt; i++)
+		ret += sizeof(double) * archives[i].rows * sources_cnt;
+	return ret;
+}
+
+
+/* ring_map */
+static void _ring_map(Ring * ring)
+{
+	RingHeader * header = ring->header;
+	double * rows;
+	uint32_t i;
+
+	ring->sources = (RingSource *)(header + 1);
+	ring->archives = (RingFileArchive *)(ring->sources
+			+ header->sources_cnt);
+	ring->points = (RingPoint *)(ring->archives + header->archives_cnt);
+	if(ring->rows == NULL)
+		return;
+	rows = (double *)(ring->points + header->archives_cnt
+			* header->sources_cnt);
+	for(i = 0; i < header->archives_cnt; i++)
+	{
+		ring->rows[i] = rows;
+		rows += ring->archives[i].rows * header->sources_cnt;
+	}
+}
+
+
+/* ring_reset */
+static void _ring_reset(Ring * ring)
+{
+	RingHeader * header = ring->header;
+	uint32_t i;
+	uint32_t j;
+	size_t cnt;
+
+	/* mark everything as unknown */
+	for(i = 0; i < header->sources_cnt; i++)
+	{
+		ring->sources[i].pdp = NAN;
+		ring->sources[i].sum = 0.0;
+		ring->sources[i].known = 0;
+	}
+	for(i = 0; i < header->archives_cnt * header->sources_cnt; i++)
+	{
+		ring->points[i].value = 0.0;
+		ring->points[i].known = 0;
+		ring->points[i].unknown = 0;
+	}
+	for(i = 0; i < header->archives_cnt; i++)
+	{
+		cnt = (size_t)ring->archives[i].rows * header->sources_cnt;
+		for(j = 0; j < cnt; j++)
+			ring->rows[i][j] = NAN;
+	}
+}
+
+
+/* ring_step */
+static void _ring_step(Ring * ring, int64_t timestamp)
+{
+	RingHeader * header = ring->header;
+	RingSource * source;
+	RingFileArchive * archive;
+	RingPoint * point;
+	double * row;
+	uint32_t i;
+	uint32_t j;
+	uint32_t total;
+
+	/* complete the primary data points */
+	for(i = 0; i < header->sources_cnt; i++)
+	{
+		source = &ring->sources[i];
+		/* at least half of the step must be known */
+		source->pdp = (source->known * 2 >= header->step)
+			? source->sum / source->known : NAN;
+		source->sum = 0.0;
+		source->known = 0;
+	}
+	/* consolidate them in every archive */
+	for(i = 0; i < header->archives_cnt; i++)
+	{
+		archive = &ring->archives[i];
+		point = &ring->points[i * header->sources_cnt];
+		for(j = 0; j < header->sources_cnt; j++)
+			if(isnan(ring->sources[j].pdp))
+				point[j].unknown++;
+			else
+			{
+				if(archive->function == RINGFUNCTION_MAX)
+					point[j].value = (point[j].known == 0
+							|| ring->sources[j].pdp
+							> point[j].value)
+						? ring->sources[j].pdp
+						: point[j].value;
+				else
+					point[j].value += ring->sources[j].pdp;
+				point[j].known++;
+			}
+		/* rows are aligned on multiples of their duration */
+		if((timestamp / header->step) % archive->steps != 0)
+			continue;
+		archive->row = (archive->row + 1) % archive->rows;
+		row = &ring->rows[i][archive->row * header->sources_cnt];
+		for(j = 0; j < header->sources_cnt; j++)
+		{
+			total = point[j].known + point[j].unknown;
+			if(point[j].known == 0 || (double)point[j].unknown
+					/ total > archive->xff)
+				row[j] = NAN;
+			else if(archive->function == RINGFUNCTION_MAX)
+				row[j] = point[j].value;
+			else
+				row[j] = point[j].value / point[j].known;
+			point[j].value = 0.0;
+			point[j].known = 0;
+			point[j].unknown = 0;
+		}
+	}
+}
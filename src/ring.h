@@ -0,0 +1,63 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#ifndef DAMON_RING_H
+# define DAMON_RING_H
+
+# include <stdbool.h>
+# include <stdio.h>
+# include <time.h>
+# include <System.h>
+
+
+/* Ring */
+/* types */
+typedef struct _Ring Ring;
+
+typedef enum _RingFunction
+{
+	RINGFUNCTION_AVERAGE = 0,
+	RINGFUNCTION_MAX
+} RingFunction;
+
+typedef struct _RingArchive
+{
+	RingFunction function;
+	double xff;				/* ratio of unknown steps */
+	unsigned int steps;			/* steps per row */
+	unsigned int rows;
+} RingArchive;
+
+
+/* functions */
+int ring_create(char const * filename, unsigned int step,
+		unsigned int heartbeat, time_t start, size_t sources_cnt,
+		RingArchive const * archives, size_t archives_cnt);
+
+Ring * ring_open(char const * filename, bool writable);
+void ring_close(Ring * ring);
+
+/* accessors */
+char const * ring_get_filename(Ring const * ring);
+
+/* useful */
+int ring_dump(Ring const * ring, FILE * fp);
+
+int ring_update(Ring * ring, time_t timestamp, double const * values,
+		size_t values_cnt);
+
+#endif /* !DAMON_RING_H */
@@ -0,0 +1,79 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#include <unistd.h>
+#include <stdio.h>
+#include <System.h>
+#include "ring.h"
+
+/* constants */
+#ifndef PROGNAME_RINGDUMP
+# define PROGNAME_RINGDUMP	"ringdump"
+#endif
+
+
+/* functions */
+/* private */
+/* prototypes */
+static int _ringdump(char const * filename);
+
+static int _ringdump_usage(void);
+
+
+/* functions */
+/* ringdump */
+static int _ringdump(char const * filename)
+{
+	int ret;
+	Ring * ring;
+
+	if((ring = ring_open(filename, false)) == NULL)
+		return error_print(PROGNAME_RINGDUMP);
+	if((ret = ring_dump(ring, stdout)) != 0)
+		error_print(PROGNAME_RINGDUMP);
+	ring_close(ring);
+	return ret;
+}
+
+
+/* ringdump_usage */
+static int _ringdump_usage(void)
+{
+	fputs("Usage: " PROGNAME_RINGDUMP " filename...\n", stderr);
+	return 1;
+}
+
+
+/* main */
+int main(int argc, char * argv[])
+{
+	int ret = 0;
+	int o;
+
+	while((o = getopt(argc, argv, "")) != -1)
+		switch(o)
+		{
+			default:
+				return _ringdump_usage();
+		}
+	if(optind == argc)
+		return _ringdump_usage();
+	for(; optind < argc; optind++)
+		if(_ringdump(argv[optind]) != 0)
+			ret = 2;
+	return ret;
+}
@@ -16,15 +16,25 @@
 
 
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <inttypes.h>
+#include <pthread.h>
+#include <netdb.h>
 #include <errno.h>
 #include <System.h>
+#ifdef DAMON_RRD_LIBRRD
+# include <rrd.h>
+#endif
+#include "ring.h"
 #include "rrd.h"
+#include "table.h"
 
 /* constants */
 #ifndef PROGNAME_DAMON
@@ -60,128 +70,371 @@
 #ifndef RRD_MAX_YEAR
 # define RRD_MAX_YEAR		"RRA:MAX:" RRD_XFF ":104:8640"
 #endif
+/* keep the native databases apart from those of rrdtool(1) */
+#ifndef RRD_NATIVE_EXTENSION
+# define RRD_NATIVE_EXTENSION	".ring"
+#endif
+/* digits in the largest 64-bit value */
+#define RRD_UINT64_LENGTH	20
+/* "timestamp:value[:value...]" */
+#define RRD_VALUES_LENGTH	((RRD_VALUES_MAX + 1) * (RRD_UINT64_LENGTH + 1))
+
+
 
 
 /* RRD */
 /* private */
+/* types */
+typedef struct _RRDCoprocess
+{
+	pid_t pid;
+	int fd;
+	FILE * fp;
+	bool busy;
+} RRDCoprocess;
+
+typedef struct _RRDPending
+{
+	String * filename;
+	char * values;				/* "timestamp:value..." */
+	size_t values_len;
+	size_t values_size;
+	unsigned int values_cnt;
+} RRDPending;
+
+typedef struct _RRDRing
+{
+	String * filename;			/* as given for rrdtool(1) */
+	Ring * ring;
+} RRDRing;
+
+struct _RRD
+{
+	String * rrdtool;
+	RRDCached * rrdcached;
+	unsigned long rrdcached_errors;
+
+	Event * event;
+	RRDEngine engine;
+
+	/* files and directories known to exist */
+	Table * known;
+
+	/* rrdtool(1) running in pipe mode */
+	RRDCoprocess * coprocesses;
+	size_t coprocesses_cnt;
+	size_t coprocesses_pos;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* samples waiting to be written */
+	unsigned int pending_samples;
+	unsigned int pending_delay;
+	Table * pending;
+	bool pending_timeout;
+
+	/* databases opened with the native engine */
+	Table * rings;
+};
+
+
 /* prototypes */
+static int _rrd_known_add(RRD * rrd, char const * path);
+static char const * _rrd_known_key(void const * entry);
+static bool _rrd_known_has(RRD * rrd, char const * path);
+static void _rrd_known_remove(RRD * rrd, char const * path);
+static void _rrd_known_reset(RRD * rrd);
+
+static int _rrd_pending_add(RRD * rrd, char const * filename,
+		char const * values, size_t len);
+static int _rrd_pending_flush(RRD * rrd, RRDPending * pending);
+static char const * _rrd_pending_key(void const * entry);
+
+static String * _rrd_ring_filename(char const * filename);
+static Ring * _rrd_ring_get(RRD * rrd, RRDSample const * sample);
+static char const * _rrd_ring_key(void const * entry);
+
+static RRDCoprocess * _rrd_coprocess_get(RRD * rrd);
+static void _rrd_coprocess_put(RRD * rrd, RRDCoprocess * coprocess);
+static int _rrd_coprocess_run(RRDCoprocess * coprocess, char * argv[]);
+static int _rrd_coprocess_start(RRD * rrd, RRDCoprocess * coprocess);
+static void _rrd_coprocess_stop(RRDCoprocess * coprocess);
 static int _rrd_exec(char * argv[]);
+#ifdef DAMON_RRD_LIBRRD
+static int _rrd_librrd_create(char const * filename, char const * step,
+		char const ** defs, size_t defs_cnt);
+static int _rrd_librrd_update(char const * filename, int argc,
+		char const ** argv);
+#endif
+static size_t _rrd_format_uint64(char * buf, uint64_t value);
 static int _rrd_perror(char const * message, int ret);
+static int _rrd_run(RRD * rrd, char * argv[]);
 static char * _rrd_timestamp(off_t offset);
+static int _rrd_update(RRD * rrd, char const * filename, char * values,
+		unsigned int values_cnt);
+
+/* callbacks */
+static int _rrd_on_flush(RRD * rrd);
 
 
 /* public */
 /* functions */
-/* rrd_create */
-static int _create_directories(char const * filename);
+/* damon_rrd_new */
+RRD * damon_rrd_new(char const * rrdtool, char const * rrdcached,
+		unsigned int coprocesses, Event * event)
+{
+	RRD * rrd;
+	size_t i;
+
+	if((rrd = object_new(sizeof(*rrd))) == NULL)
+		return NULL;
+	rrd->rrdtool = string_new((rrdtool != NULL) ? rrdtool : RRDTOOL);
+	rrd->rrdcached = (rrdcached != NULL)
+		? rrdcached_new(rrdcached, event) : NULL;
+	rrd->coprocesses = (coprocesses > 0)
+		? malloc(sizeof(*rrd->coprocesses) * coprocesses) : NULL;
+	rrd->rrdcached_errors = 0;
+	rrd->event = event;
+	rrd->engine = RRDENGINE_RRDTOOL;
+	rrd->known = table_new(_rrd_known_key);
+	rrd->coprocesses_cnt = 0;
+	rrd->coprocesses_pos = 0;
+	rrd->pending = table_new(_rrd_pending_key);
+	rrd->rings = table_new(_rrd_ring_key);
+	if(rrd->rrdtool == NULL
+			|| (rrdcached != NULL && rrd->rrdcached == NULL)
+			|| (coprocesses > 0 && rrd->coprocesses == NULL)
+			|| rrd->known == NULL || rrd->pending == NULL
+			|| rrd->rings == NULL)
+	{
+		if(rrd->rings != NULL)
+			table_delete(rrd->rings);
+		if(rrd->pending != NULL)
+			table_delete(rrd->pending);
+		if(rrd->known != NULL)
+			table_delete(rrd->known);
+		free(rrd->coprocesses);
+		if(rrd->rrdcached != NULL)
+			rrdcached_delete(rrd->rrdcached);
+		string_delete(rrd->rrdtool);
+		object_delete(rrd);
+		return NULL;
+	}
+	/* the coprocesses are started on demand */
+	for(i = 0; i < coprocesses; i++)
+	{
+		rrd->coprocesses[i].pid = -1;
+		rrd->coprocesses[i].fd = -1;
+		rrd->coprocesses[i].fp = NULL;
+		rrd->coprocesses[i].busy = false;
+	}
+	rrd->coprocesses_cnt = coprocesses;
+	pthread_mutex_init(&rrd->mutex, NULL);
+	pthread_cond_init(&rrd->cond, NULL);
+	rrd->pending_samples = 1;
+	rrd->pending_delay = 0;
+	rrd->pending_timeout = false;
+	return rrd;
+}
 
-int rrd_create(RRDType type, char const * rrdcached, char const * filename)
+
+/* damon_rrd_delete */
+void damon_rrd_delete(RRD * rrd)
 {
-	int ret;
-	char * argv[22] = { RRDTOOL, "create", NULL, "--start", NULL };
-	size_t i = 5;
+	size_t i;
+	RRDPending * pending;
+	RRDRing * ring;
 
-	/* create parent directories */
-	if(_create_directories(filename) != 0)
-		return -1;
-	if(rrdcached != NULL)
+	if(damon_rrd_flush(rrd) != 0)
+		error_print(PROGNAME_DAMON);
+	for(i = 0; (pending = table_get_next(rrd->pending, &i)) != NULL;)
 	{
-		argv[i++] = "--daemon";
-		if((argv[i++] = string_new(rrdcached)) == NULL)
-			return -1;
+		string_delete(pending->filename);
+		free(pending->values);
+		object_delete(pending);
+	}
+	table_delete(rrd->pending);
+	for(i = 0; (ring = table_get_next(rrd->rings, &i)) != NULL;)
+	{
+		ring_close(ring->ring);
+		string_delete(ring->filename);
+		object_delete(ring);
 	}
+	table_delete(rrd->rings);
+	for(i = 0; i < rrd->coprocesses_cnt; i++)
+		_rrd_coprocess_stop(&rrd->coprocesses[i]);
+	free(rrd->coprocesses);
+	_rrd_known_reset(rrd);
+	table_delete(rrd->known);
+	pthread_cond_destroy(&rrd->cond);
+	pthread_mutex_destroy(&rrd->mutex);
+	if(rrd->rrdcached != NULL)
+		rrdcached_delete(rrd->rrdcached);
+	string_delete(rrd->rrdtool);
+	object_delete(rrd);
+}
+
+
+/* accessors */
+/* damon_rrd_set_buffering */
+int damon_rrd_set_buffering(RRD * rrd, unsigned int samples,
+		unsigned int delay)
+{
+	int ret;
+
+	/* without an event loop, damon_rrd_flush() has to be called instead */
+	if(samples > 1 && delay == 0 && rrd->event != NULL)
+		return error_set_code(-EINVAL, "%s", strerror(EINVAL));
+	ret = damon_rrd_flush(rrd);
+	rrd->pending_samples = (samples > 0) ? samples : 1;
+	rrd->pending_delay = delay;
+	return ret;
+}
+
+
+/* damon_rrd_set_engine */
+int damon_rrd_set_engine(RRD * rrd, RRDEngine engine)
+{
+	int ret;
+
+	ret = damon_rrd_flush(rrd);
+	_rrd_known_reset(rrd);
+	rrd->engine = engine;
+	return ret;
+}
+
+
+/* useful */
+/* damon_rrd_create */
+static int _create_directories(RRD * rrd, char const * filename);
+static int _create_native(char const * filename, char const * step,
+		char const ** defs, size_t defs_cnt);
+
+int damon_rrd_create(RRD * rrd, RRDType type, char const * filename)
+{
+	int ret;
+	char const * step = "300";
+	char const * defs[11];
+	size_t defs_cnt = 0;
+	char * argv[22] = { NULL, "create", NULL, "--start", NULL };
+	size_t i = 5;
+	size_t j;
+
 	switch(type)
 	{
 		case RRDTYPE_LOAD:
-			argv[i++] = "--step";
-			argv[i++] = "300";
-			argv[i++] = "DS:load1:GAUGE:600:0:U";
-			argv[i++] = "DS:load5:GAUGE:600:0:U";
-			argv[i++] = "DS:load15:GAUGE:600:0:U";
-			argv[i++] = RRD_AVERAGE_DAY;
-			argv[i++] = RRD_AVERAGE_WEEK;
-			argv[i++] = RRD_AVERAGE_4WEEK;
-			argv[i++] = RRD_AVERAGE_YEAR;
-			argv[i++] = RRD_MAX_DAY;
-			argv[i++] = RRD_MAX_WEEK;
-			argv[i++] = RRD_MAX_4WEEK;
-			argv[i++] = RRD_MAX_YEAR;
+			defs[defs_cnt++] = "DS:load1:GAUGE:600:0:U";
+			defs[defs_cnt++] = "DS:load5:GAUGE:600:0:U";
+			defs[defs_cnt++] = "DS:load15:GAUGE:600:0:U";
 			break;
 		case RRDTYPE_PROCS:
-			argv[i++] = "--step";
-			argv[i++] = "300";
-			argv[i++] = "DS:procs:GAUGE:600:0:U";
-			argv[i++] = RRD_AVERAGE_DAY;
-			argv[i++] = RRD_AVERAGE_WEEK;
-			argv[i++] = RRD_AVERAGE_4WEEK;
-			argv[i++] = RRD_AVERAGE_YEAR;
-			argv[i++] = RRD_MAX_DAY;
-			argv[i++] = RRD_MAX_WEEK;
-			argv[i++] = RRD_MAX_4WEEK;
-			argv[i++] = RRD_MAX_YEAR;
+			defs[defs_cnt++] = "DS:procs:GAUGE:600:0:U";
 			break;
 		case RRDTYPE_UPGRADES:
-			argv[i++] = "--step";
-			argv[i++] = "300";
-			argv[i++] = "DS:upgrades:GAUGE:600:0:U";
-			argv[i++] = RRD_AVERAGE_DAY;
-			argv[i++] = RRD_AVERAGE_WEEK;
-			argv[i++] = RRD_AVERAGE_4WEEK;
-			argv[i++] = RRD_AVERAGE_YEAR;
-			argv[i++] = RRD_MAX_DAY;
-			argv[i++] = RRD_MAX_WEEK;
-			argv[i++] = RRD_MAX_4WEEK;
-			argv[i++] = RRD_MAX_YEAR;
+			defs[defs_cnt++] = "DS:upgrades:GAUGE:600:0:U";
 			break;
 		case RRDTYPE_USERS:
-			argv[i++] = "--step";
-			argv[i++] = "300";
-			argv[i++] = "DS:users:GAUGE:600:0:U";
-			argv[i++] = RRD_AVERAGE_DAY;
-			argv[i++] = RRD_AVERAGE_WEEK;
-			argv[i++] = RRD_AVERAGE_4WEEK;
-			argv[i++] = RRD_AVERAGE_YEAR;
-			argv[i++] = RRD_MAX_DAY;
-			argv[i++] = RRD_MAX_WEEK;
-			argv[i++] = RRD_MAX_4WEEK;
-			argv[i++] = RRD_MAX_YEAR;
+			defs[defs_cnt++] = "DS:users:GAUGE:600:0:U";
 			break;
 		case RRDTYPE_VOLUME:
-			argv[i++] = "--step";
-			argv[i++] = "300";
-			argv[i++] = "DS:used:GAUGE:600:0:U";
-			argv[i++] = "DS:total:GAUGE:600:0:U";
-			argv[i++] = RRD_AVERAGE_DAY;
-			argv[i++] = RRD_AVERAGE_WEEK;
-			argv[i++] = RRD_AVERAGE_4WEEK;
-			argv[i++] = RRD_AVERAGE_YEAR;
-			argv[i++] = RRD_MAX_DAY;
-			argv[i++] = RRD_MAX_WEEK;
-			argv[i++] = RRD_MAX_4WEEK;
-			argv[i++] = RRD_MAX_YEAR;
+			defs[defs_cnt++] = "DS:used:GAUGE:600:0:U";
+			defs[defs_cnt++] = "DS:total:GAUGE:600:0:U";
 			break;
 		default:
 			/* unsupported graph */
-			if(rrdcached != NULL)
-				string_delete(argv[6]);
 			return -1;
 	}
+	defs[defs_cnt++] = RRD_AVERAGE_DAY;
+	defs[defs_cnt++] = RRD_AVERAGE_WEEK;
+	defs[defs_cnt++] = RRD_AVERAGE_4WEEK;
+	defs[defs_cnt++] = RRD_AVERAGE_YEAR;
+	defs[defs_cnt++] = RRD_MAX_DAY;
+	defs[defs_cnt++] = RRD_MAX_WEEK;
+	defs[defs_cnt++] = RRD_MAX_4WEEK;
+	defs[defs_cnt++] = RRD_MAX_YEAR;
+	/* create parent directories */
+	if(_create_directories(rrd, filename) != 0)
+		return -1;
+	if(rrd->engine == RRDENGINE_NATIVE)
+		return _create_native(filename, step, defs, defs_cnt);
+#ifdef DAMON_RRD_LIBRRD
+	if(rrd->rrdcached == NULL)
+		return _rrd_librrd_create(filename, step, defs, defs_cnt);
+#endif
+	argv[0] = rrd->rrdtool;
+	if(rrd->rrdcached != NULL)
+	{
+		argv[i++] = "--daemon";
+		if((argv[i++] = string_new(rrdcached_get_address(
+							rrd->rrdcached)))
+				== NULL)
+			return -1;
+	}
+	argv[i++] = "--step";
+	argv[i++] = (char *)step;
+	for(j = 0; j < defs_cnt; j++)
+		argv[i++] = (char *)defs[j];
 	argv[2] = string_new(filename);
 	argv[4] = _rrd_timestamp(-1);
 	argv[i++] = NULL;
 	/* create the database */
 	if(argv[2] != NULL && argv[4] != NULL)
-		ret = _rrd_exec(argv);
+		ret = _rrd_run(rrd, argv);
 	else
 		ret = -1;
-	if(rrdcached != NULL)
+	if(rrd->rrdcached != NULL)
 		string_delete(argv[6]);
 	string_delete(argv[4]);
 	string_delete(argv[2]);
 	return ret;
 }
 
-static int _create_directories(char const * filename)
+static int _create_native(char const * filename, char const * step,
+		char const ** defs, size_t defs_cnt)
+{
+	int ret;
+	String * native;
+	RingArchive archives[8];
+	size_t archives_cnt = 0;
+	size_t sources_cnt = 0;
+	unsigned int heartbeat = 0;
+	char function[8];
+	RingArchive * archive;
+	size_t i;
+	struct timeval tv;
+
+	/* follow the definitions given to rrdtool(1) */
+	for(i = 0; i < defs_cnt; i++)
+	{
+		archive = &archives[archives_cnt];
+		if(sscanf(defs[i], "DS:%*[^:]:GAUGE:%u:", &heartbeat) == 1)
+			sources_cnt++;
+		else if(archives_cnt < sizeof(archives) / sizeof(*archives)
+				&& sscanf(defs[i], "RRA:%7[A-Z]:%lf:%u:%u",
+					function, &archive->xff,
+					&archive->steps, &archive->rows) == 4
+				&& (strcmp(function, "AVERAGE") == 0
+					|| strcmp(function, "MAX") == 0))
+		{
+			archive->function = (strcmp(function, "MAX") == 0)
+				? RINGFUNCTION_MAX : RINGFUNCTION_AVERAGE;
+			archives_cnt++;
+		}
+		else
+			return error_set_code(-EINVAL, "%s: %s: %s", filename,
+					defs[i], "Unsupported definition");
+	}
+	if(gettimeofday(&tv, NULL) != 0)
+		return _rrd_perror("gettimeofday", -errno);
+	if((native = _rrd_ring_filename(filename)) == NULL)
+		return -1;
+	ret = ring_create(native, strtoul(step, NULL, 10), heartbeat,
+			tv.tv_sec - 1, sources_cnt, archives, archives_cnt);
+	string_delete(native);
+	return ret;
+}
+
+static int _create_directories(RRD * rrd, char const * filename)
 {
 	int ret = 0;
 	char * p;
@@ -194,12 +447,16 @@ static int _create_directories(char const * filename)
 		if(i == 0 || p[i] != '/')
 			continue;
 		p[i] = '\0';
-		if(mkdir(p, 0777) != 0 && errno != EEXIST)
+		if(!_rrd_known_has(rrd, p))
 		{
-			error_set_print(PROGNAME_DAMON, -errno, "%s: %s", p,
-					strerror(errno));
-			ret = -1;
-			break;
+			if(mkdir(p, 0777) != 0 && errno != EEXIST)
+			{
+				error_set_print(PROGNAME_DAMON, -errno,
+						"%s: %s", p, strerror(errno));
+				ret = -1;
+				break;
+			}
+			_rrd_known_add(rrd, p);
 		}
 		p[i] = '/';
 	}
@@ -208,82 +465,538 @@ static int _create_directories(char const * filename)
 }
 
 
-/* rrd_update */
-int rrd_update(RRDType type, char const * rrdcached, char const * filename, int
-		args_cnt, ...)
+/* damon_rrd_flush */
+int damon_rrd_flush(RRD * rrd)
 {
-	int ret;
-	va_list args;
+	int ret = 0;
+	size_t i;
+	RRDPending * pending;
+
+	if(rrd->pending_timeout)
+	{
+		event_unregister_timeout(rrd->event,
+				(EventTimeoutFunc)_rrd_on_flush);
+		rrd->pending_timeout = false;
+	}
+	for(i = 0; (pending = table_get_next(rrd->pending, &i)) != NULL;)
+		if(pending->values_cnt > 0
+				&& _rrd_pending_flush(rrd, pending) != 0)
+			ret = -1;
+	return ret;
+}
+
+
+/* damon_rrd_update */
+static int _update_native(RRD * rrd, RRDSample const * sample, time_t now);
+static int _update_sample(RRD * rrd, RRDSample const * sample, time_t now);
+static size_t _update_format(char * buf, RRDSample const * sample,
+		time_t now);
+
+int damon_rrd_update(RRD * rrd, RRDSample const * samples, size_t samples_cnt)
+{
+	int ret = 0;
+	struct timeval tv;
+	size_t i;
 
-	va_start(args, args_cnt);
-	ret = rrd_updatev(type, rrdcached, filename, args_cnt, args);
-	va_end(args);
+	if(gettimeofday(&tv, NULL) != 0)
+		return _rrd_perror("gettimeofday", -errno);
+	for(i = 0; i < samples_cnt; i++)
+		/* samples without any value are skipped */
+		if(samples[i].values_cnt > 0
+				&& _update_sample(rrd, &samples[i], tv.tv_sec)
+				!= 0)
+			ret = -1;
 	return ret;
 }
 
+static int _update_native(RRD * rrd, RRDSample const * sample, time_t now)
+{
+	Ring * ring;
+	double values[RRD_VALUES_MAX];
+	size_t i;
+
+	if((ring = _rrd_ring_get(rrd, sample)) == NULL)
+		return -1;
+	for(i = 0; i < sample->values_cnt; i++)
+		values[i] = sample->values[i];
+	return ring_update(ring, (sample->timestamp != 0) ? sample->timestamp
+			: now, values, sample->values_cnt);
+}
 
-/* rrd_updatev */
-int rrd_updatev(RRDType type, char const * rrdcached, char const * filename,
-		int args_cnt, va_list args)
+static int _update_sample(RRD * rrd, RRDSample const * sample, time_t now)
 {
 	struct stat st;
-	char * argv[] = { RRDTOOL, "update", NULL, NULL, NULL, NULL, NULL };
-	size_t i = 3;
-	struct timeval tv;
-	size_t s;
-	int pos;
-	int arg;
-	int ret;
+	char values[RRD_VALUES_LENGTH];
+	size_t len;
 
 #ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s(%u, \"%s\")\n", __func__, type, filename);
+	fprintf(stderr, "DEBUG: %s(%u, \"%s\")\n", __func__, sample->type,
+			sample->filename);
 #endif
+	if(sample->values_cnt > RRD_VALUES_MAX)
+		return error_set_code(-EINVAL, "%s: %s", sample->filename,
+				strerror(EINVAL));
+	if(rrd->engine == RRDENGINE_NATIVE)
+		return _update_native(rrd, sample, now);
+	/* forget everything if rrdcached reported errors meanwhile */
+	if(rrd->rrdcached != NULL && rrdcached_get_errors(rrd->rrdcached)
+			!= rrd->rrdcached_errors)
+	{
+		rrd->rrdcached_errors = rrdcached_get_errors(rrd->rrdcached);
+		_rrd_known_reset(rrd);
+	}
 	/* create the database if not available */
-	if(stat(filename, &st) != 0)
+	if(!_rrd_known_has(rrd, sample->filename))
 	{
-		if(errno != ENOENT)
-			return _rrd_perror(filename, -errno);
-		if(rrd_create(type, rrdcached, filename) != 0)
+		if(stat(sample->filename, &st) != 0)
+		{
+			if(errno != ENOENT)
+				return _rrd_perror(sample->filename, -errno);
+			if(damon_rrd_create(rrd, sample->type,
+						sample->filename) != 0)
+				return -1;
+		}
+		_rrd_known_add(rrd, sample->filename);
+	}
+	len = _update_format(values, sample, now);
+	/* keep the sample for later if buffering */
+	if(rrd->pending_samples > 1)
+		return _rrd_pending_add(rrd, sample->filename, values, len);
+	return _rrd_update(rrd, sample->filename, values, 1);
+}
+
+static size_t _update_format(char * buf, RRDSample const * sample,
+		time_t now)
+{
+	size_t pos;
+	size_t i;
+
+	/* "timestamp:value[:value...]" */
+	pos = _rrd_format_uint64(buf, (sample->timestamp != 0)
+			? (uint64_t)sample->timestamp : (uint64_t)now);
+	for(i = 0; i < sample->values_cnt; i++)
+	{
+		buf[pos++] = ':';
+		pos += _rrd_format_uint64(&buf[pos], sample->values[i]);
+	}
+	buf[pos] = '\0';
+	return pos;
+}
+
+
+/* private */
+/* functions */
+/* rrd_known_add */
+static int _rrd_known_add(RRD * rrd, char const * path)
+{
+	int ret = 0;
+	String * p;
+
+	pthread_mutex_lock(&rrd->mutex);
+	if(table_get(rrd->known, path) == NULL)
+	{
+		if((p = string_new(path)) == NULL)
+			ret = -1;
+		else if((ret = table_add(rrd->known, p)) != 0)
+			string_delete(p);
+	}
+	pthread_mutex_unlock(&rrd->mutex);
+	return ret;
+}
+
+static char const * _rrd_known_key(void const * entry)
+{
+	return entry;
+}
+
+
+/* rrd_known_has */
+static bool _rrd_known_has(RRD * rrd, char const * path)
+{
+	bool ret;
+
+	pthread_mutex_lock(&rrd->mutex);
+	ret = (table_get(rrd->known, path) != NULL) ? true : false;
+	pthread_mutex_unlock(&rrd->mutex);
+	return ret;
+}
+
+
+/* rrd_known_remove */
+static void _rrd_known_remove(RRD * rrd, char const * path)
+{
+	String * p;
+	size_t len;
+
+	if((p = string_new(path)) == NULL)
+	{
+		_rrd_known_reset(rrd);
+		return;
+	}
+	/* the directories may be gone as well */
+	pthread_mutex_lock(&rrd->mutex);
+	for(len = string_get_length(p); len > 0;)
+	{
+		p[len] = '\0';
+		string_delete(table_remove(rrd->known, p));
+		while(len > 0 && p[--len] != '/');
+	}
+	pthread_mutex_unlock(&rrd->mutex);
+	string_delete(p);
+}
+
+
+/* rrd_known_reset */
+static void _rrd_known_reset(RRD * rrd)
+{
+	size_t i;
+	String * p;
+
+	pthread_mutex_lock(&rrd->mutex);
+	for(i = 0; (p = table_get_next(rrd->known, &i)) != NULL;)
+		string_delete(p);
+	table_clear(rrd->known);
+	pthread_mutex_unlock(&rrd->mutex);
+}
+
+
+/* rrd_pending_add */
+static int _rrd_pending_add(RRD * rrd, char const * filename,
+		char const * values, size_t len)
+{
+	RRDPending * pending;
+	size_t size;
+	char * q;
+	struct timeval tv;
+
+	/* entries are kept once allocated */
+	if((pending = table_get(rrd->pending, filename)) == NULL)
+	{
+		if((pending = object_new(sizeof(*pending))) == NULL)
+			return -1;
+		pending->values = NULL;
+		pending->values_len = 0;
+		pending->values_size = 0;
+		pending->values_cnt = 0;
+		if((pending->filename = string_new(filename)) == NULL
+				|| table_add(rrd->pending, pending) != 0)
+		{
+			string_delete(pending->filename);
+			object_delete(pending);
 			return -1;
+		}
 	}
-	/* prepare the parameters */
-	if(gettimeofday(&tv, NULL) != 0)
-		return _rrd_perror("gettimeofday", -errno);
-	if((argv[2] = string_new(filename)) == NULL)
+	/* separate the samples with spaces */
+	if(pending->values_len + len + 2 > pending->values_size)
+	{
+		size = pending->values_len + len + 2;
+		size = (size > pending->values_size * 2) ? size
+			: pending->values_size * 2;
+		if((q = realloc(pending->values, size)) == NULL)
+			return _rrd_perror(NULL, -errno);
+		pending->values = q;
+		pending->values_size = size;
+	}
+	if(pending->values_cnt > 0)
+		pending->values[pending->values_len++] = ' ';
+	memcpy(&pending->values[pending->values_len], values, len + 1);
+	pending->values_len += len;
+	if(++pending->values_cnt >= rrd->pending_samples)
+		return _rrd_pending_flush(rrd, pending);
+	/* flush whatever is left after the delay */
+	if(rrd->event != NULL && !rrd->pending_timeout)
+	{
+		tv.tv_sec = rrd->pending_delay;
+		tv.tv_usec = 0;
+		if(event_register_timeout(rrd->event, &tv,
+					(EventTimeoutFunc)_rrd_on_flush, rrd)
+				== 0)
+			rrd->pending_timeout = true;
+	}
+	return 0;
+}
+
+
+/* rrd_pending_flush */
+static int _rrd_pending_flush(RRD * rrd, RRDPending * pending)
+{
+	int ret;
+
+	ret = _rrd_update(rrd, pending->filename, pending->values,
+			pending->values_cnt);
+	pending->values_len = 0;
+	pending->values_cnt = 0;
+	return ret;
+}
+
+static char const * _rrd_pending_key(void const * entry)
+{
+	RRDPending const * pending = entry;
+
+	return pending->filename;
+}
+
+
+/* rrd_ring_get */
+static String * _rrd_ring_filename(char const * filename)
+{
+	String * ret;
+	size_t len;
+	size_t ext = sizeof(".rrd") - 1;
+
+	/* "<metric>.rrd" becomes "<metric>" RRD_NATIVE_EXTENSION */
+	len = string_get_length(filename);
+	if(len <= ext || strcmp(&filename[len - ext], ".rrd") != 0)
+		return string_new_append(filename, RRD_NATIVE_EXTENSION, NULL);
+	if((ret = string_new_length(filename, len - ext)) == NULL)
+		return NULL;
+	if(string_append(&ret, RRD_NATIVE_EXTENSION) != 0)
+	{
+		string_delete(ret);
+		return NULL;
+	}
+	return ret;
+}
+
+static Ring * _rrd_ring_get(RRD * rrd, RRDSample const * sample)
+{
+	int ret = 0;
+	RRDRing * ring;
+	String * filename;
+	struct stat st;
+
+	if((ring = table_get(rrd->rings, sample->filename)) != NULL)
+		return ring->ring;
+	if((filename = _rrd_ring_filename(sample->filename)) == NULL)
+		return NULL;
+	/* create the database if not available */
+	if(stat(filename, &st) != 0)
+		ret = (errno == ENOENT) ? damon_rrd_create(rrd, sample->type,
+				sample->filename) : _rrd_perror(filename, -errno);
+	if(ret != 0 || (ring = object_new(sizeof(*ring))) == NULL)
+	{
+		string_delete(filename);
+		return NULL;
+	}
+	/* the database remains open and mapped */
+	ring->filename = string_new(sample->filename);
+	ring->ring = ring_open(filename, true);
+	string_delete(filename);
+	if(ring->filename == NULL || ring->ring == NULL
+			|| table_add(rrd->rings, ring) != 0)
+	{
+		if(ring->ring != NULL)
+			ring_close(ring->ring);
+		string_delete(ring->filename);
+		object_delete(ring);
+		return NULL;
+	}
+	return ring->ring;
+}
+
+static char const * _rrd_ring_key(void const * entry)
+{
+	RRDRing const * ring = entry;
+
+	return ring->filename;
+}
+
+
+/* rrd_coprocess_get */
+static RRDCoprocess * _rrd_coprocess_get(RRD * rrd)
+{
+	RRDCoprocess * coprocess = NULL;
+	size_t i;
+
+	if(rrd->coprocesses_cnt == 0)
+		return NULL;
+	pthread_mutex_lock(&rrd->mutex);
+	while(coprocess == NULL)
+	{
+		/* spread the commands across the pool */
+		for(i = 0; i < rrd->coprocesses_cnt; i++)
+		{
+			coprocess = &rrd->coprocesses[(rrd->coprocesses_pos
+					+ i) % rrd->coprocesses_cnt];
+			if(!coprocess->busy)
+				break;
+			coprocess = NULL;
+		}
+		if(coprocess == NULL)
+			pthread_cond_wait(&rrd->cond, &rrd->mutex);
+	}
+	coprocess->busy = true;
+	rrd->coprocesses_pos = (rrd->coprocesses_pos + i + 1)
+		% rrd->coprocesses_cnt;
+	pthread_mutex_unlock(&rrd->mutex);
+	if(coprocess->pid < 0 && _rrd_coprocess_start(rrd, coprocess) != 0)
+	{
+		_rrd_coprocess_put(rrd, coprocess);
+		return NULL;
+	}
+	return coprocess;
+}
+
+
+/* rrd_coprocess_put */
+static void _rrd_coprocess_put(RRD * rrd, RRDCoprocess * coprocess)
+{
+	pthread_mutex_lock(&rrd->mutex);
+	coprocess->busy = false;
+	pthread_cond_signal(&rrd->cond);
+	pthread_mutex_unlock(&rrd->mutex);
+}
+
+
+/* rrd_coprocess_run */
+static int _coprocess_run_append(String ** command, char const * arg);
+
+static int _rrd_coprocess_run(RRDCoprocess * coprocess, char * argv[])
+{
+	String * command;
+	size_t i;
+	size_t len;
+	ssize_t res;
+	char buf[256];
+	int flags = 0;
+
+	/* the command is sent without the name of the program */
+	if((command = string_new("")) == NULL)
 		return 1;
-	if(rrdcached != NULL)
+	for(i = 1; argv[i] != NULL; i++)
 	{
-		argv[i++] = "--daemon";
-		if((argv[i++] = string_new(rrdcached)) == NULL)
+		if(i > 1 && string_append(&command, " ") != 0)
 		{
-			string_delete(argv[2]);
+			string_delete(command);
 			return 1;
 		}
+		/* or run on its own instead */
+		if(_coprocess_run_append(&command, argv[i]) != 0)
+		{
+			string_delete(command);
+			return -1;
+		}
 	}
-	s = (args_cnt + 1) * 12;
-	if((argv[i] = malloc(s)) == NULL)
-	{
-		if(rrdcached != NULL)
-			string_delete(argv[4]);
-		string_delete(argv[2]);
-		return _rrd_perror(NULL, -errno);
-	}
-	pos = snprintf(argv[i], s, "%ld", tv.tv_sec);
-	for(arg = 0; arg < args_cnt; arg++)
-		pos += snprintf(&argv[i][pos], s - pos, ":%"PRIu64,
-				va_arg(args, uint64_t));
-	/* update the database */
-	ret = _rrd_exec(argv);
-	free(argv[i]);
-	if(rrdcached != NULL)
-		string_delete(argv[4]);
-	string_delete(argv[2]);
-	return ret;
+	if(string_append(&command, "\n") != 0)
+	{
+		string_delete(command);
+		return 1;
+	}
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() %s", __func__, command);
+#endif
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	len = string_get_length(command);
+	for(i = 0; i < len; i += res)
+		if((res = send(coprocess->fd, &command[i], len - i, flags))
+				< 0)
+		{
+			if(errno == EINTR)
+			{
+				res = 0;
+				continue;
+			}
+			string_delete(command);
+			_rrd_coprocess_stop(coprocess);
+			return _rrd_perror("send", -errno);
+		}
+	string_delete(command);
+	/* the output ends with either OK or ERROR */
+	while(fgets(buf, sizeof(buf), coprocess->fp) != NULL)
+	{
+		if(strncmp(buf, "OK", 2) == 0)
+			return 0;
+		if(strncmp(buf, "ERROR", 5) == 0)
+		{
+			buf[strcspn(buf, "\n")] = '\0';
+			return error_set_code(1, "%s", buf);
+		}
+	}
+	_rrd_coprocess_stop(coprocess);
+	return error_set_code(-1, "%s", "rrdtool: Unexpected end of output");
+}
+
+static int _coprocess_run_append(String ** command, char const * arg)
+{
+	char const * quote;
+
+	/* rrdtool splits the lines on blanks, except within quotes */
+	if(arg[0] != '\0' && strpbrk(arg, " \t\"'") == NULL)
+		return string_append(command, arg);
+	if(strchr(arg, '\n') != NULL
+			|| (strchr(arg, '"') != NULL && strchr(arg, '\'') != NULL))
+		return error_set_code(-1, "%s: %s", arg,
+				"Unsupported argument in pipe mode");
+	quote = (strchr(arg, '"') != NULL) ? "'" : "\"";
+	if(string_append(command, quote) != 0
+			|| string_append(command, arg) != 0
+			|| string_append(command, quote) != 0)
+		return -1;
+	return 0;
+}
+
+
+/* rrd_coprocess_start */
+static int _rrd_coprocess_start(RRD * rrd, RRDCoprocess * coprocess)
+{
+	int fds[2];
+	char * argv[] = { NULL, "-", NULL };
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return _rrd_perror("socketpair", -errno);
+	/* avoid leaking this end into the other coprocesses */
+	if(fcntl(fds[0], F_SETFD, FD_CLOEXEC) != 0
+			|| (coprocess->pid = fork()) == -1)
+	{
+		_rrd_perror("fork", -errno);
+		close(fds[0]);
+		close(fds[1]);
+		coprocess->pid = -1;
+		return -1;
+	}
+	if(coprocess->pid == 0)
+	{
+		close(fds[0]);
+		if(dup2(fds[1], 0) == -1 || dup2(fds[1], 1) == -1)
+			_exit(2);
+		close(fds[1]);
+		argv[0] = rrd->rrdtool;
+		execvp(argv[0], argv);
+		_rrd_perror(argv[0], 1);
+		_exit(2);
+	}
+	close(fds[1]);
+	coprocess->fd = fds[0];
+	if((coprocess->fp = fdopen(coprocess->fd, "r")) == NULL)
+	{
+		_rrd_perror("fdopen", -errno);
+		_rrd_coprocess_stop(coprocess);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* rrd_coprocess_stop */
+static void _rrd_coprocess_stop(RRDCoprocess * coprocess)
+{
+	int status;
+
+	if(coprocess->fp != NULL)
+		fclose(coprocess->fp);
+	else if(coprocess->fd >= 0)
+		close(coprocess->fd);
+	if(coprocess->pid > 0)
+		while(waitpid(coprocess->pid, &status, 0) == -1
+				&& errno == EINTR);
+	coprocess->pid = -1;
+	coprocess->fd = -1;
+	coprocess->fp = NULL;
 }
 
 
-/* private */
-/* functions */
 /* rrd_exec */
 static int _rrd_exec(char * argv[])
 {
@@ -314,6 +1027,57 @@ static int _rrd_exec(char * argv[])
 }
 
 
+#ifdef DAMON_RRD_LIBRRD
+/* rrd_librrd_create */
+static int _rrd_librrd_create(char const * filename, char const * step,
+		char const ** defs, size_t defs_cnt)
+{
+	struct timeval tv;
+
+	if(gettimeofday(&tv, NULL) != 0)
+		return _rrd_perror("gettimeofday", -errno);
+	rrd_clear_error();
+	if(rrd_create_r(filename, strtoul(step, NULL, 10), tv.tv_sec - 1,
+				defs_cnt, defs) != 0)
+		return error_set_code(-1, "%s: %s", filename,
+				rrd_get_error());
+	return 0;
+}
+
+
+/* rrd_librrd_update */
+static int _rrd_librrd_update(char const * filename, int argc,
+		char const ** argv)
+{
+	rrd_clear_error();
+	if(rrd_update_r(filename, NULL, argc, argv) != 0)
+		return error_set_code(-1, "%s: %s", filename,
+				rrd_get_error());
+	return 0;
+}
+#endif
+
+
+/* rrd_format_uint64 */
+static size_t _rrd_format_uint64(char * buf, uint64_t value)
+{
+	char digits[RRD_UINT64_LENGTH];
+	size_t i = sizeof(digits);
+	size_t len;
+
+	/* fill the digits from the end */
+	do
+	{
+		digits[--i] = '0' + (value % 10);
+		value /= 10;
+	}
+	while(value != 0);
+	len = sizeof(digits) - i;
+	memcpy(buf, &digits[i], len);
+	return len;
+}
+
+
 /* rrd_perror */
 static int _rrd_perror(char const * message, int ret)
 {
@@ -322,6 +1086,26 @@ static int _rrd_perror(char const * message, int ret)
 }
 
 
+/* rrd_run */
+static int _rrd_run(RRD * rrd, char * argv[])
+{
+	int ret;
+	RRDCoprocess * coprocess;
+
+	if((coprocess = _rrd_coprocess_get(rrd)) == NULL)
+		return _rrd_exec(argv);
+	ret = _rrd_coprocess_run(coprocess, argv);
+	_rrd_coprocess_put(rrd, coprocess);
+	/* the coprocess is gone, run the command on its own instead */
+	if(ret < 0)
+	{
+		error_print(PROGNAME_DAMON);
+		ret = _rrd_exec(argv);
+	}
+	return ret;
+}
+
+
 /* rrd_timestamp */
 static char * _rrd_timestamp(off_t offset)
 {
@@ -334,3 +1118,605 @@ static char * _rrd_timestamp(off_t offset)
 	}
 	return string_new_format("%ld", tv.tv_sec + offset);
 }
+
+
+/* damon_rrd_update */
+static int _rrd_update(RRD * rrd, char const * filename, char * values,
+		unsigned int values_cnt)
+{
+	int ret;
+	char * argv1[5];
+	char ** argv;
+	char * p;
+	unsigned int i;
+
+	if(rrd->rrdcached != NULL)
+		ret = rrdcached_update(rrd->rrdcached, filename, values);
+	else if((argv = (values_cnt == 1) ? argv1
+				: malloc(sizeof(*argv) * (values_cnt + 4)))
+			== NULL)
+		ret = _rrd_perror(NULL, -errno);
+	else
+	{
+		argv[0] = rrd->rrdtool;
+		argv[1] = "update";
+		argv[2] = (char *)filename;
+		/* one argument per sample */
+		for(i = 0, p = values; i < values_cnt && p != NULL; i++)
+		{
+			argv[3 + i] = p;
+			if((p = strchr(p, ' ')) != NULL)
+				*(p++) = '\0';
+		}
+		argv[3 + i] = NULL;
+#ifdef DAMON_RRD_LIBRRD
+		ret = _rrd_librrd_update(filename, i,
+				(char const **)&argv[3]);
+#else
+		ret = _rrd_run(rrd, argv);
+#endif
+		if(argv != argv1)
+			free(argv);
+	}
+	if(ret != 0)
+		/* the file or its directories may be gone */
+		_rrd_known_remove(rrd, filename);
+	return ret;
+}
+
+
+/* callbacks */
+/* rrd_on_flush */
+static int _rrd_on_flush(RRD * rrd)
+{
+	size_t i;
+	RRDPending * pending;
+
+	rrd->pending_timeout = false;
+	for(i = 0; (pending = table_get_next(rrd->pending, &i)) != NULL;)
+		if(pending->values_cnt > 0
+				&& _rrd_pending_flush(rrd, pending) != 0)
+			error_print(PROGNAME_DAMON);
+	/* unregister the timeout */
+	return 1;
+}
+
+
+/* RRDCached */
+/* private */
+/* types */
+typedef enum _RRDCachedState
+{
+	RCS_BATCH = 0,
+	RCS_RESULT,
+	RCS_ERRORS
+} RRDCachedState;
+
+typedef struct _RRDCachedBatch
+{
+	char * output;
+	size_t * commands;
+	size_t commands_cnt;
+	RRDCachedState state;
+	unsigned long errors;
+} RRDCachedBatch;
+
+struct _RRDCached
+{
+	String * address;
+	Event * event;
+	int fd;
+	char * directory;			/* for the relative paths */
+
+	/* commands not sent yet */
+	char * output;
+	size_t output_len;
+	size_t output_size;
+	size_t * commands;			/* offsets in the output */
+	size_t commands_cnt;
+	size_t commands_size;
+	bool timeout;
+
+	unsigned long errors;
+
+	/* batches sent and waiting for a reply */
+	RRDCachedBatch * batches;
+	size_t batches_cnt;
+	char input[1024];
+	size_t input_len;
+};
+
+
+/* constants */
+#ifndef RRDCACHED_PORT
+# define RRDCACHED_PORT		"42217"
+#endif
+/* flush the batch when either limit is reached */
+#define RRDCACHED_FLUSH_DELAY	1
+#define RRDCACHED_FLUSH_SIZE	65536
+
+
+/* prototypes */
+static void _rrdcached_batch_destroy(RRDCachedBatch * batch);
+static int _rrdcached_connect(RRDCached * rrdcached);
+static void _rrdcached_disconnect(RRDCached * rrdcached);
+static int _rrdcached_append(RRDCached * rrdcached, char const * string,
+		size_t len);
+static int _rrdcached_append_filename(RRDCached * rrdcached,
+		char const * filename);
+static int _rrdcached_on_flush(RRDCached * rrdcached);
+static int _rrdcached_on_read(int fd, RRDCached * rrdcached);
+static void _rrdcached_reply(RRDCached * rrdcached, char const * line);
+
+
+/* public */
+/* functions */
+/* rrdcached_new */
+RRDCached * rrdcached_new(char const * address, Event * event)
+{
+	RRDCached * rrdcached;
+
+	if((rrdcached = object_new(sizeof(*rrdcached))) == NULL)
+		return NULL;
+	memset(rrdcached, 0, sizeof(*rrdcached));
+	rrdcached->event = event;
+	rrdcached->fd = -1;
+	/* the daemon resolves relative paths against its own directory */
+	if((rrdcached->directory = realpath(".", NULL)) == NULL)
+	{
+		_rrd_perror(".", -errno);
+		object_delete(rrdcached);
+		return NULL;
+	}
+	if((rrdcached->address = string_new(address)) == NULL)
+	{
+		free(rrdcached->directory);
+		object_delete(rrdcached);
+		return NULL;
+	}
+	return rrdcached;
+}
+
+
+/* rrdcached_delete */
+void rrdcached_delete(RRDCached * rrdcached)
+{
+	if(rrdcached->timeout)
+		event_unregister_timeout(rrdcached->event,
+				(EventTimeoutFunc)_rrdcached_on_flush);
+	rrdcached_flush(rrdcached);
+	_rrdcached_disconnect(rrdcached);
+	free(rrdcached->commands);
+	free(rrdcached->output);
+	free(rrdcached->directory);
+	string_delete(rrdcached->address);
+	object_delete(rrdcached);
+}
+
+
+/* accessors */
+/* rrdcached_get_address */
+char const * rrdcached_get_address(RRDCached * rrdcached)
+{
+	return rrdcached->address;
+}
+
+
+/* rrdcached_get_errors */
+unsigned long rrdcached_get_errors(RRDCached * rrdcached)
+{
+	return rrdcached->errors;
+}
+
+
+/* useful */
+/* rrdcached_flush */
+int rrdcached_flush(RRDCached * rrdcached)
+{
+	RRDCachedBatch * batch;
+	size_t i;
+	size_t len;
+	ssize_t res;
+	int flags = 0;
+
+	if(rrdcached->commands_cnt == 0)
+		return 0;
+	if(_rrdcached_append(rrdcached, ".\n", 2) != 0)
+		return -1;
+	if((rrdcached->fd < 0 && _rrdcached_connect(rrdcached) != 0)
+			|| (batch = realloc(rrdcached->batches, sizeof(*batch)
+					* (rrdcached->batches_cnt + 1)))
+			== NULL)
+	{
+		error_set_code(-1, "%s: %lu update(s) lost", rrdcached->address,
+				(unsigned long)rrdcached->commands_cnt);
+		rrdcached->commands_cnt = 0;
+		rrdcached->output_len = 0;
+		return -1;
+	}
+	rrdcached->batches = batch;
+	batch = &rrdcached->batches[rrdcached->batches_cnt++];
+	batch->output = rrdcached->output;
+	batch->commands = rrdcached->commands;
+	batch->commands_cnt = rrdcached->commands_cnt;
+	batch->state = RCS_BATCH;
+	batch->errors = 0;
+	/* send the whole batch at once */
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	len = rrdcached->output_len;
+	for(i = 0; i < len; i += res)
+		if((res = send(rrdcached->fd, &rrdcached->output[i], len - i,
+						flags)) < 0)
+		{
+			if(errno == EINTR)
+			{
+				res = 0;
+				continue;
+			}
+			_rrd_perror(rrdcached->address, -errno);
+			break;
+		}
+	/* the batch keeps the commands for the replies */
+	rrdcached->output = NULL;
+	rrdcached->output_len = 0;
+	rrdcached->output_size = 0;
+	rrdcached->commands = NULL;
+	rrdcached->commands_cnt = 0;
+	rrdcached->commands_size = 0;
+	if(i < len)
+	{
+		_rrdcached_disconnect(rrdcached);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* rrdcached_update */
+int rrdcached_update(RRDCached * rrdcached, char const * filename,
+		char const * values)
+{
+	size_t * p;
+	size_t size;
+	size_t len;
+	struct timeval tv;
+
+	/* one command per line */
+	if(strchr(filename, '\n') != NULL)
+		return error_set_code(-EINVAL, "%s", "Invalid filename");
+	if(rrdcached->commands_cnt == rrdcached->commands_size)
+	{
+		size = (rrdcached->commands_size > 0)
+			? rrdcached->commands_size * 2 : 256;
+		if((p = realloc(rrdcached->commands, sizeof(*p) * size))
+				== NULL)
+			return _rrd_perror(NULL, -errno);
+		rrdcached->commands = p;
+		rrdcached->commands_size = size;
+	}
+	if(rrdcached->commands_cnt == 0
+			&& _rrdcached_append(rrdcached, "BATCH\n", 6) != 0)
+		return -1;
+	len = rrdcached->output_len;
+	if(_rrdcached_append(rrdcached, "UPDATE ", 7) != 0
+			|| _rrdcached_append_filename(rrdcached, filename) != 0
+			|| _rrdcached_append(rrdcached, " ", 1) != 0
+			|| _rrdcached_append(rrdcached, values,
+				strlen(values)) != 0
+			|| _rrdcached_append(rrdcached, "\n", 1) != 0)
+	{
+		rrdcached->output_len = len;
+		return -1;
+	}
+	rrdcached->commands[rrdcached->commands_cnt++] = len;
+	if(rrdcached->output_len >= RRDCACHED_FLUSH_SIZE)
+		return rrdcached_flush(rrdcached);
+	if(!rrdcached->timeout)
+	{
+		tv.tv_sec = RRDCACHED_FLUSH_DELAY;
+		tv.tv_usec = 0;
+		if(event_register_timeout(rrdcached->event, &tv,
+					(EventTimeoutFunc)_rrdcached_on_flush,
+					rrdcached) == 0)
+			rrdcached->timeout = true;
+	}
+	return 0;
+}
+
+
+/* private */
+/* functions */
+/* rrdcached_batch_destroy */
+static void _rrdcached_batch_destroy(RRDCachedBatch * batch)
+{
+	free(batch->commands);
+	free(batch->output);
+}
+
+
+/* rrdcached_connect */
+static int _connect_tcp(RRDCached * rrdcached, char const * address);
+static int _connect_unix(RRDCached * rrdcached, char const * path);
+
+static int _rrdcached_connect(RRDCached * rrdcached)
+{
+	char const prefix[] = "unix:";
+	int ret;
+
+	if(strncmp(rrdcached->address, prefix, sizeof(prefix) - 1) == 0)
+		ret = _connect_unix(rrdcached,
+				&rrdcached->address[sizeof(prefix) - 1]);
+	else if(rrdcached->address[0] == '/')
+		ret = _connect_unix(rrdcached, rrdcached->address);
+	else
+		ret = _connect_tcp(rrdcached, rrdcached->address);
+	if(ret != 0)
+		return ret;
+	rrdcached->input_len = 0;
+	event_register_io_read(rrdcached->event, rrdcached->fd,
+			(EventIOFunc)_rrdcached_on_read, rrdcached);
+	return 0;
+}
+
+static int _connect_tcp(RRDCached * rrdcached, char const * address)
+{
+	String * host;
+	char const * port = RRDCACHED_PORT;
+	char * p;
+	struct addrinfo hints;
+	struct addrinfo * ai;
+	struct addrinfo * aip;
+	int res;
+
+	if((host = string_new(address)) == NULL)
+		return -1;
+	/* [address]:port or address:port */
+	if(host[0] == '[' && (p = strchr(host, ']')) != NULL)
+	{
+		memmove(host, &host[1], p - host - 1);
+		p[-1] = '\0';
+		if(p[1] == ':')
+			port = &p[2];
+	}
+	else if((p = strrchr(host, ':')) != NULL && strchr(host, ':') == p)
+	{
+		*(p++) = '\0';
+		port = p;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if((res = getaddrinfo(host, port, &hints, &ai)) != 0)
+	{
+		error_set_code(-1, "%s: %s", address, gai_strerror(res));
+		string_delete(host);
+		return -1;
+	}
+	string_delete(host);
+	for(aip = ai; aip != NULL; aip = aip->ai_next)
+	{
+		if((rrdcached->fd = socket(aip->ai_family, aip->ai_socktype,
+						aip->ai_protocol)) < 0)
+			continue;
+		if(connect(rrdcached->fd, aip->ai_addr, aip->ai_addrlen) == 0)
+			break;
+		close(rrdcached->fd);
+		rrdcached->fd = -1;
+	}
+	freeaddrinfo(ai);
+	if(rrdcached->fd < 0)
+		return _rrd_perror(address, -errno);
+	return 0;
+}
+
+static int _connect_unix(RRDCached * rrdcached, char const * path)
+{
+	struct sockaddr_un sun;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(sun.sun_path))
+		return error_set_code(-1, "%s: %s", path,
+				strerror(ENAMETOOLONG));
+	strcpy(sun.sun_path, path);
+	if((rrdcached->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return _rrd_perror("socket", -errno);
+	if(connect(rrdcached->fd, (struct sockaddr *)&sun, sizeof(sun)) != 0)
+	{
+		_rrd_perror(path, -errno);
+		close(rrdcached->fd);
+		rrdcached->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+
+/* rrdcached_disconnect */
+static void _rrdcached_disconnect(RRDCached * rrdcached)
+{
+	size_t i;
+
+	if(rrdcached->fd >= 0)
+	{
+		event_unregister_io_read(rrdcached->event, rrdcached->fd);
+		close(rrdcached->fd);
+		rrdcached->fd = -1;
+	}
+	/* the replies to the pending batches are lost */
+	for(i = 0; i < rrdcached->batches_cnt; i++)
+		_rrdcached_batch_destroy(&rrdcached->batches[i]);
+	free(rrdcached->batches);
+	rrdcached->batches = NULL;
+	rrdcached->batches_cnt = 0;
+}
+
+
+/* rrdcached_append */
+static int _rrdcached_append(RRDCached * rrdcached, char const * string,
+		size_t len)
+{
+	size_t size;
+	char * p;
+
+	if(rrdcached->output_len + len > rrdcached->output_size)
+	{
+		for(size = (rrdcached->output_size > 0)
+				? rrdcached->output_size : 4096;
+				rrdcached->output_len + len > size; size *= 2);
+		if((p = realloc(rrdcached->output, size)) == NULL)
+			return _rrd_perror(NULL, -errno);
+		rrdcached->output = p;
+		rrdcached->output_size = size;
+	}
+	memcpy(&rrdcached->output[rrdcached->output_len], string, len);
+	rrdcached->output_len += len;
+	return 0;
+}
+
+
+/* rrdcached_append_filename */
+static int _rrdcached_append_filename(RRDCached * rrdcached,
+		char const * filename)
+{
+	size_t len;
+
+	/* as resolved when created through rrdtool --daemon */
+	if(filename[0] != '/')
+	{
+		while(strncmp(filename, "./", 2) == 0)
+			filename += 2;
+		if(_rrdcached_append(rrdcached, rrdcached->directory,
+					strlen(rrdcached->directory)) != 0
+				|| _rrdcached_append(rrdcached, "/", 1) != 0)
+			return -1;
+	}
+	/* escape the separators of the arguments */
+	for(;;)
+	{
+		len = strcspn(filename, " \\");
+		if(_rrdcached_append(rrdcached, filename, len) != 0)
+			return -1;
+		if(filename[len] == '\0')
+			return 0;
+		if(_rrdcached_append(rrdcached, "\\", 1) != 0
+				|| _rrdcached_append(rrdcached, &filename[len],
+					1) != 0)
+			return -1;
+		filename += len + 1;
+	}
+}
+
+
+/* callbacks */
+/* rrdcached_on_flush */
+static int _rrdcached_on_flush(RRDCached * rrdcached)
+{
+	rrdcached->timeout = false;
+	if(rrdcached_flush(rrdcached) != 0)
+		error_print(PROGNAME_DAMON);
+	/* unregister the timeout */
+	return 1;
+}
+
+
+/* rrdcached_on_read */
+static int _rrdcached_on_read(int fd, RRDCached * rrdcached)
+{
+	ssize_t res;
+	char * p;
+	char * q;
+
+	if((res = read(fd, &rrdcached->input[rrdcached->input_len],
+					sizeof(rrdcached->input)
+					- rrdcached->input_len)) <= 0)
+	{
+		if(res < 0 && errno == EINTR)
+			return 0;
+		if(res < 0)
+			error_set_print(PROGNAME_DAMON, 1, "%s: %s",
+					rrdcached->address, strerror(errno));
+		/* the socket is closed below */
+		rrdcached->fd = -1;
+		close(fd);
+		_rrdcached_disconnect(rrdcached);
+		return 1;
+	}
+	rrdcached->input_len += res;
+	/* process every complete line */
+	for(p = rrdcached->input; (q = memchr(p, '\n', rrdcached->input_len
+					- (p - rrdcached->input))) != NULL;
+			p = q + 1)
+	{
+		*q = '\0';
+		_rrdcached_reply(rrdcached, p);
+	}
+	rrdcached->input_len -= p - rrdcached->input;
+	if(rrdcached->input_len == sizeof(rrdcached->input))
+		/* discard overly long lines */
+		rrdcached->input_len = 0;
+	memmove(rrdcached->input, p, rrdcached->input_len);
+	return 0;
+}
+
+
+/* rrdcached_reply */
+static void _rrdcached_reply(RRDCached * rrdcached, char const * line)
+{
+	RRDCachedBatch * batch;
+	long res;
+	char * p;
+	char const * command;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, line);
+#endif
+	if(rrdcached->batches_cnt == 0)
+		/* unexpected reply */
+		return;
+	batch = &rrdcached->batches[0];
+	res = strtol(line, &p, 10);
+	switch(batch->state)
+	{
+		case RCS_BATCH:
+			if(res < 0)
+			{
+				/* the whole batch was rejected */
+				error_set_print(PROGNAME_DAMON, 1, "%s: %s",
+						rrdcached->address, line);
+				rrdcached->errors++;
+				break;
+			}
+			batch->state = RCS_RESULT;
+			return;
+		case RCS_RESULT:
+			if(res <= 0)
+				break;
+			batch->state = RCS_ERRORS;
+			batch->errors = res;
+			return;
+		case RCS_ERRORS:
+			/* the commands are numbered from 1, after BATCH */
+			if(res >= 1 && (size_t)res <= batch->commands_cnt)
+			{
+				/* "UPDATE filename values" */
+				command = &batch->output[batch->commands[
+					res - 1] + 7];
+				error_set_print(PROGNAME_DAMON, 1,
+						"%s: %.*s:%s",
+						rrdcached->address,
+						(int)strcspn(command, " "),
+						command, p);
+			}
+			rrdcached->errors++;
+			if(--batch->errors > 0)
+				return;
+			break;
+	}
+	/* this batch is complete */
+	_rrdcached_batch_destroy(batch);
+	memmove(batch, &batch[1], sizeof(*batch)
+			* --rrdcached->batches_cnt);
+}
@@ -18,11 +18,23 @@
 #ifndef DAMON_RRD_H
 # define DAMON_RRD_H
 
-# include <stdarg.h>
+# include <stdint.h>
+# include <time.h>
+# include <System.h>
 
 
 /* RRD */
+/* constants */
+# define RRD_VALUES_MAX		4
+
+
 /* types */
+typedef enum _RRDEngine
+{
+	RRDENGINE_RRDTOOL = 0,
+	RRDENGINE_NATIVE
+} RRDEngine;
+
 typedef enum _RRDType
 {
 	RRDTYPE_UNKNOWN = 0,
@@ -33,13 +45,50 @@ typedef enum _RRDType
 	RRDTYPE_VOLUME
 } RRDType;
 
+typedef struct _RRD RRD;
+
+typedef struct _RRDSample
+{
+	time_t timestamp;			/* 0 for the current time */
+	RRDType type;
+	char const * filename;
+	size_t values_cnt;
+	uint64_t values[RRD_VALUES_MAX];
+} RRDSample;
+
+typedef struct _RRDCached RRDCached;
+
 
 /* functions */
-int rrd_create(RRDType type, char const * rrdcached, char const * filename);
+RRD * damon_rrd_new(char const * rrdtool, char const * rrdcached,
+		unsigned int coprocesses, Event * event);
+void damon_rrd_delete(RRD * rrd);
+
+/* accessors */
+int damon_rrd_set_buffering(RRD * rrd, unsigned int samples,
+		unsigned int delay);
+int damon_rrd_set_engine(RRD * rrd, RRDEngine engine);
+
+/* useful */
+int damon_rrd_create(RRD * rrd, RRDType type, char const * filename);
+
+int damon_rrd_flush(RRD * rrd);
+
+int damon_rrd_update(RRD * rrd, RRDSample const * samples, size_t samples_cnt);
+
+
+/* RRDCached */
+/* functions */
+RRDCached * rrdcached_new(char const * address, Event * event);
+void rrdcached_delete(RRDCached * rrdcached);
+
+/* accessors */
+char const * rrdcached_get_address(RRDCached * rrdcached);
+unsigned long rrdcached_get_errors(RRDCached * rrdcached);
 
-int rrd_update(RRDType type, char const * rrdcached, char const * filename,
-		int args_cnt, ...);
-int rrd_updatev(RRDType type, char const * rrdcached, char const * filename,
-		int args_cnt, va_list args);
+/* useful */
+int rrdcached_flush(RRDCached * rrdcached);
+int rrdcached_update(RRDCached * rrdcached, char const * filename,
+		char const * values);
 
 #endif /* !DAMON_RRD_H */
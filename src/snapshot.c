@@ -0,0 +1,785 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* The wire format is a sequence of big-endian integers:
+ * - version (32 bits)
+ * - uptime, load[3], ram[4], swap[2], procs, users (64 bits each)
+ * - interfaces count (32 bits), then for each interface:
+ *   name length (16 bits), name, rxbytes, txbytes (64 bits each)
+ * - volumes count (32 bits), then for each volume:
+ *   name length (16 bits), name, total, free (64 bits each)
+ *
+ * Deltas only carry what changed since a previous snapshot:
+ * - version (32 bits, SNAPSHOT_VERSION_DELTA)
+ * - mask of the values changed (32 bits), then each value changed
+ *   (in the order above, 64 bits each)
+ * - interfaces count (32 bits), interfaces changed (32 bits), then for each:
+ *   index (32 bits), name length (16 bits), name, rxbytes, txbytes
+ * - volumes count (32 bits), volumes changed (32 bits), then for each:
+ *   index (32 bits), name length (16 bits), name, total, free
+ *
+ * Histories are a sequence of entries, each made of:
+ * - sequence number (32 bits), timestamp (64 bits)
+ * - size (32 bits), then a snapshot or a delta over the previous entry
+ *
+ * Summaries cover the values taken over a range of snapshots:
+ * - version (32 bits, SNAPSHOT_VERSION_SUMMARY)
+ * - snapshots summarized (32 bits), values count (32 bits)
+ * - then for each value (in the order above): min, max, sum, last
+ *   (64 bits each) */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <System.h>
+#include "snapshot.h"
+
+
+/* Snapshot */
+/* private */
+/* prototypes */
+static size_t _snapshot_get_size(Snapshot const * snapshot);
+static void _snapshot_get_values(Snapshot const * snapshot, uint64_t * values);
+
+static void _snapshot_set_values(Snapshot * snapshot, uint64_t const * values);
+
+static int _snapshot_decode_data(Snapshot * snapshot, char const * p,
+		char const * end);
+static int _snapshot_decode_delta(Snapshot * snapshot, char const * p,
+		char const * end);
+
+static int _snapshot_decode_string(char const ** p, char const * end,
+		char * string, size_t size);
+static int _snapshot_decode_uint16(char const ** p, char const * end,
+		uint16_t * value);
+static int _snapshot_decode_uint32(char const ** p, char const * end,
+		uint32_t * value);
+static int _snapshot_decode_uint64(char const ** p, char const * end,
+		uint64_t * value);
+
+static void _snapshot_encode_string(char ** p, char const * string);
+static void _snapshot_encode_uint16(char ** p, uint16_t value);
+static void _snapshot_encode_uint32(char ** p, uint32_t value);
+static void _snapshot_encode_uint64(char ** p, uint64_t value);
+
+
+/* public */
+/* functions */
+/* snapshot_new */
+Snapshot * snapshot_new(void)
+{
+	Snapshot * snapshot;
+
+	if((snapshot = object_new(sizeof(*snapshot))) == NULL)
+		return NULL;
+	memset(snapshot, 0, sizeof(*snapshot));
+	return snapshot;
+}
+
+
+/* snapshot_delete */
+void snapshot_delete(Snapshot * snapshot)
+{
+	free(snapshot->ifaces);
+	free(snapshot->vols);
+	object_delete(snapshot);
+}
+
+
+/* accessors */
+/* snapshot_get_interface */
+SnapshotInterface * snapshot_get_interface(Snapshot * snapshot,
+		char const * name)
+{
+	size_t i;
+
+	for(i = 0; i < snapshot->ifaces_cnt; i++)
+		if(strcmp(snapshot->ifaces[i].name, name) == 0)
+			return &snapshot->ifaces[i];
+	return NULL;
+}
+
+
+/* snapshot_get_volume */
+SnapshotVolume * snapshot_get_volume(Snapshot * snapshot, char const * name)
+{
+	size_t i;
+
+	for(i = 0; i < snapshot->vols_cnt; i++)
+		if(strcmp(snapshot->vols[i].name, name) == 0)
+			return &snapshot->vols[i];
+	return NULL;
+}
+
+
+/* snapshot_set_interface_name */
+int snapshot_set_interface_name(Snapshot * snapshot, size_t i,
+		char const * name)
+{
+	size_t len;
+
+	/* never truncated, as it is looked up again by name */
+	if((len = strlen(name)) >= sizeof(snapshot->ifaces[i].name))
+		return error_set_code(-1, "%s: %s", name,
+				strerror(ENAMETOOLONG));
+	memcpy(snapshot->ifaces[i].name, name, len + 1);
+	return 0;
+}
+
+
+/* snapshot_set_interfaces_count */
+int snapshot_set_interfaces_count(Snapshot * snapshot, size_t count)
+{
+	SnapshotInterface * p;
+
+	if(count == 0)
+	{
+		free(snapshot->ifaces);
+		snapshot->ifaces = NULL;
+	}
+	else if((p = realloc(snapshot->ifaces, sizeof(*p) * count)) == NULL)
+		return error_set_code(-1, "%s", strerror(errno));
+	else
+		snapshot->ifaces = p;
+	snapshot->ifaces_cnt = count;
+	return 0;
+}
+
+
+/* snapshot_set_volume_name */
+int snapshot_set_volume_name(Snapshot * snapshot, size_t i, char const * name)
+{
+	size_t len;
+
+	if((len = strlen(name)) >= sizeof(snapshot->vols[i].name))
+		return error_set_code(-1, "%s: %s", name,
+				strerror(ENAMETOOLONG));
+	memcpy(snapshot->vols[i].name, name, len + 1);
+	return 0;
+}
+
+
+/* snapshot_set_volumes_count */
+int snapshot_set_volumes_count(Snapshot * snapshot, size_t count)
+{
+	SnapshotVolume * p;
+
+	if(count == 0)
+	{
+		free(snapshot->vols);
+		snapshot->vols = NULL;
+	}
+	else if((p = realloc(snapshot->vols, sizeof(*p) * count)) == NULL)
+		return error_set_code(-1, "%s", strerror(errno));
+	else
+		snapshot->vols = p;
+	snapshot->vols_cnt = count;
+	return 0;
+}
+
+
+/* useful */
+/* snapshot_decode */
+int snapshot_decode(Snapshot * snapshot, Buffer const * buffer)
+{
+	char const * p = buffer_get_data(buffer);
+
+	return _snapshot_decode_data(snapshot, p, p + buffer_get_size(buffer));
+}
+
+
+/* snapshot_encode */
+int snapshot_encode(Snapshot const * snapshot, Buffer * buffer)
+{
+	size_t size;
+	char * p;
+	size_t i;
+
+	size = _snapshot_get_size(snapshot);
+	if(buffer_set_size(buffer, size) != 0)
+		return -1;
+	p = buffer_get_data(buffer);
+	_snapshot_encode_uint32(&p, SNAPSHOT_VERSION);
+	_snapshot_encode_uint64(&p, snapshot->uptime);
+	for(i = 0; i < sizeof(snapshot->load) / sizeof(*snapshot->load); i++)
+		_snapshot_encode_uint64(&p, snapshot->load[i]);
+	for(i = 0; i < sizeof(snapshot->ram) / sizeof(*snapshot->ram); i++)
+		_snapshot_encode_uint64(&p, snapshot->ram[i]);
+	for(i = 0; i < sizeof(snapshot->swap) / sizeof(*snapshot->swap); i++)
+		_snapshot_encode_uint64(&p, snapshot->swap[i]);
+	_snapshot_encode_uint64(&p, snapshot->procs);
+	_snapshot_encode_uint64(&p, snapshot->users);
+	_snapshot_encode_uint32(&p, snapshot->ifaces_cnt);
+	for(i = 0; i < snapshot->ifaces_cnt; i++)
+	{
+		_snapshot_encode_string(&p, snapshot->ifaces[i].name);
+		_snapshot_encode_uint64(&p, snapshot->ifaces[i].rxbytes);
+		_snapshot_encode_uint64(&p, snapshot->ifaces[i].txbytes);
+	}
+	_snapshot_encode_uint32(&p, snapshot->vols_cnt);
+	for(i = 0; i < snapshot->vols_cnt; i++)
+	{
+		_snapshot_encode_string(&p, snapshot->vols[i].name);
+		_snapshot_encode_uint64(&p, snapshot->vols[i].total);
+		_snapshot_encode_uint64(&p, snapshot->vols[i].free);
+	}
+	return 0;
+}
+
+
+/* snapshot_encode_delta */
+static void _encode_delta_ifaces(Snapshot const * snapshot,
+		Snapshot const * base, char ** p);
+static void _encode_delta_vols(Snapshot const * snapshot,
+		Snapshot const * base, char ** p);
+
+int snapshot_encode_delta(Snapshot const * snapshot, Snapshot const * base,
+		Buffer * buffer)
+{
+	size_t size;
+	char * p;
+	char * mask;
+	uint64_t values[SNAPSHOT_VALUES_COUNT];
+	uint64_t bases[SNAPSHOT_VALUES_COUNT];
+	uint32_t changed = 0;
+	size_t i;
+
+	if(base == NULL)
+		return snapshot_encode(snapshot, buffer);
+	/* at worst, every entry changed */
+	size = _snapshot_get_size(snapshot) + sizeof(uint32_t) * 3
+		+ sizeof(uint32_t) * (snapshot->ifaces_cnt + snapshot->vols_cnt);
+	if(buffer_set_size(buffer, size) != 0)
+		return -1;
+	p = buffer_get_data(buffer);
+	_snapshot_encode_uint32(&p, SNAPSHOT_VERSION_DELTA);
+	mask = p;
+	_snapshot_encode_uint32(&p, 0);
+	_snapshot_get_values(snapshot, values);
+	_snapshot_get_values(base, bases);
+	for(i = 0; i < SNAPSHOT_VALUES_COUNT; i++)
+		if(values[i] != bases[i])
+		{
+			changed |= 1 << i;
+			_snapshot_encode_uint64(&p, values[i]);
+		}
+	_snapshot_encode_uint32(&mask, changed);
+	_encode_delta_ifaces(snapshot, base, &p);
+	_encode_delta_vols(snapshot, base, &p);
+	return buffer_set_size(buffer, p - buffer_get_data(buffer));
+}
+
+static void _encode_delta_ifaces(Snapshot const * snapshot,
+		Snapshot const * base, char ** p)
+{
+	char * changed;
+	uint32_t cnt = 0;
+	size_t i;
+	SnapshotInterface const * iface;
+
+	_snapshot_encode_uint32(p, snapshot->ifaces_cnt);
+	changed = *p;
+	_snapshot_encode_uint32(p, 0);
+	for(i = 0; i < snapshot->ifaces_cnt; i++)
+	{
+		iface = &snapshot->ifaces[i];
+		/* compared with the same position */
+		if(i < base->ifaces_cnt
+				&& strcmp(iface->name, base->ifaces[i].name) == 0
+				&& iface->rxbytes == base->ifaces[i].rxbytes
+				&& iface->txbytes == base->ifaces[i].txbytes)
+			continue;
+		_snapshot_encode_uint32(p, i);
+		_snapshot_encode_string(p, iface->name);
+		_snapshot_encode_uint64(p, iface->rxbytes);
+		_snapshot_encode_uint64(p, iface->txbytes);
+		cnt++;
+	}
+	_snapshot_encode_uint32(&changed, cnt);
+}
+
+static void _encode_delta_vols(Snapshot const * snapshot,
+		Snapshot const * base, char ** p)
+{
+	char * changed;
+	uint32_t cnt = 0;
+	size_t i;
+	SnapshotVolume const * vol;
+
+	_snapshot_encode_uint32(p, snapshot->vols_cnt);
+	changed = *p;
+	_snapshot_encode_uint32(p, 0);
+	for(i = 0; i < snapshot->vols_cnt; i++)
+	{
+		vol = &snapshot->vols[i];
+		if(i < base->vols_cnt
+				&& strcmp(vol->name, base->vols[i].name) == 0
+				&& vol->total == base->vols[i].total
+				&& vol->free == base->vols[i].free)
+			continue;
+		_snapshot_encode_uint32(p, i);
+		_snapshot_encode_string(p, vol->name);
+		_snapshot_encode_uint64(p, vol->total);
+		_snapshot_encode_uint64(p, vol->free);
+		cnt++;
+	}
+	_snapshot_encode_uint32(&changed, cnt);
+}
+
+
+/* snapshot_history_append */
+int snapshot_history_append(Buffer * buffer, uint32_t seq, time_t timestamp,
+		Snapshot const * snapshot, Snapshot const * base)
+{
+	Buffer * entry;
+	size_t offset;
+	size_t size;
+	char * p;
+
+	if((entry = buffer_new(0, NULL)) == NULL)
+		return -1;
+	if(snapshot_encode_delta(snapshot, base, entry) != 0)
+	{
+		buffer_delete(entry);
+		return -1;
+	}
+	offset = buffer_get_size(buffer);
+	size = buffer_get_size(entry);
+	if(buffer_set_size(buffer, offset + sizeof(uint32_t) * 2
+				+ sizeof(uint64_t) + size) != 0)
+	{
+		buffer_delete(entry);
+		return -1;
+	}
+	p = buffer_get_data(buffer) + offset;
+	_snapshot_encode_uint32(&p, seq);
+	_snapshot_encode_uint64(&p, timestamp);
+	_snapshot_encode_uint32(&p, size);
+	memcpy(p, buffer_get_data(entry), size);
+	buffer_delete(entry);
+	return 0;
+}
+
+
+/* snapshot_history_decode */
+int snapshot_history_decode(Buffer const * buffer, size_t * offset,
+		uint32_t * seq, time_t * timestamp, Snapshot * snapshot)
+{
+	char const * p = buffer_get_data(buffer) + *offset;
+	char const * end = buffer_get_data(buffer) + buffer_get_size(buffer);
+	uint64_t u64;
+	uint32_t size;
+
+	if(_snapshot_decode_uint32(&p, end, seq) != 0
+			|| _snapshot_decode_uint64(&p, end, &u64) != 0
+			|| _snapshot_decode_uint32(&p, end, &size) != 0)
+		return -1;
+	if(size > end - p)
+		return error_set_code(-1, "%s", "Truncated snapshot");
+	/* applied over the previous entry */
+	if(_snapshot_decode_data(snapshot, p, p + size) != 0)
+		return -1;
+	*timestamp = u64;
+	*offset = p + size - buffer_get_data(buffer);
+	return 0;
+}
+
+
+/* snapshot_summary_reset */
+void snapshot_summary_reset(SnapshotSummary * summary)
+{
+	memset(summary, 0, sizeof(*summary));
+}
+
+
+/* snapshot_summary_decode */
+int snapshot_summary_decode(SnapshotSummary * summary, Buffer const * buffer)
+{
+	char const * p = buffer_get_data(buffer);
+	char const * end = p + buffer_get_size(buffer);
+	uint32_t u32;
+	size_t i;
+
+	if(_snapshot_decode_uint32(&p, end, &u32) != 0)
+		return -1;
+	if(u32 != SNAPSHOT_VERSION_SUMMARY)
+		return error_set_code(-1, "%s%u",
+				"Unsupported summary version ", u32);
+	if(_snapshot_decode_uint32(&p, end, &summary->count) != 0
+			|| _snapshot_decode_uint32(&p, end, &u32) != 0)
+		return -1;
+	if(u32 != SNAPSHOT_VALUES_COUNT)
+		return error_set_code(-1, "%s", "Unsupported summary");
+	for(i = 0; i < SNAPSHOT_VALUES_COUNT; i++)
+		if(_snapshot_decode_uint64(&p, end, &summary->min[i]) != 0
+				|| _snapshot_decode_uint64(&p, end,
+					&summary->max[i]) != 0
+				|| _snapshot_decode_uint64(&p, end,
+					&summary->sum[i]) != 0
+				|| _snapshot_decode_uint64(&p, end,
+					&summary->last[i]) != 0)
+			return -1;
+	return 0;
+}
+
+
+/* snapshot_summary_encode */
+int snapshot_summary_encode(SnapshotSummary const * summary, Buffer * buffer)
+{
+	char * p;
+	size_t i;
+
+	if(buffer_set_size(buffer, sizeof(uint32_t) * 3
+				+ sizeof(uint64_t) * 4 * SNAPSHOT_VALUES_COUNT)
+			!= 0)
+		return -1;
+	p = buffer_get_data(buffer);
+	_snapshot_encode_uint32(&p, SNAPSHOT_VERSION_SUMMARY);
+	_snapshot_encode_uint32(&p, summary->count);
+	_snapshot_encode_uint32(&p, SNAPSHOT_VALUES_COUNT);
+	for(i = 0; i < SNAPSHOT_VALUES_COUNT; i++)
+	{
+		_snapshot_encode_uint64(&p, summary->min[i]);
+		_snapshot_encode_uint64(&p, summary->max[i]);
+		_snapshot_encode_uint64(&p, summary->sum[i]);
+		_snapshot_encode_uint64(&p, summary->last[i]);
+	}
+	return 0;
+}
+
+
+/* snapshot_summary_update */
+void snapshot_summary_update(SnapshotSummary * summary,
+		Snapshot const * snapshot)
+{
+	uint64_t values[SNAPSHOT_VALUES_COUNT];
+	size_t i;
+
+	_snapshot_get_values(snapshot, values);
+	for(i = 0; i < SNAPSHOT_VALUES_COUNT; i++)
+	{
+		if(summary->count == 0 || values[i] < summary->min[i])
+			summary->min[i] = values[i];
+		if(summary->count == 0 || values[i] > summary->max[i])
+			summary->max[i] = values[i];
+		summary->sum[i] += values[i];
+		summary->last[i] = values[i];
+	}
+	summary->count++;
+}
+
+
+/* private */
+/* functions */
+/* snapshot_get_size */
+static size_t _snapshot_get_size(Snapshot const * snapshot)
+{
+	size_t ret;
+	size_t i;
+
+	ret = sizeof(uint32_t) + sizeof(uint64_t) * 12;
+	ret += sizeof(uint32_t);
+	for(i = 0; i < snapshot->ifaces_cnt; i++)
+		ret += sizeof(uint16_t) + strlen(snapshot->ifaces[i].name)
+			+ sizeof(uint64_t) * 2;
+	ret += sizeof(uint32_t);
+	for(i = 0; i < snapshot->vols_cnt; i++)
+		ret += sizeof(uint16_t) + strlen(snapshot->vols[i].name)
+			+ sizeof(uint64_t) * 2;
+	return ret;
+}
+
+
+/* snapshot_get_values */
+static void _snapshot_get_values(Snapshot const * snapshot, uint64_t * values)
+{
+	values[0] = snapshot->uptime;
+	memcpy(&values[1], snapshot->load, sizeof(snapshot->load));
+	memcpy(&values[4], snapshot->ram, sizeof(snapshot->ram));
+	memcpy(&values[8], snapshot->swap, sizeof(snapshot->swap));
+	values[10] = snapshot->procs;
+	values[11] = snapshot->users;
+}
+
+
+/* snapshot_set_values */
+static void _snapshot_set_values(Snapshot * snapshot, uint64_t const * values)
+{
+	snapshot->uptime = values[0];
+	memcpy(snapshot->load, &values[1], sizeof(snapshot->load));
+	memcpy(snapshot->ram, &values[4], sizeof(snapshot->ram));
+	memcpy(snapshot->swap, &values[8], sizeof(snapshot->swap));
+	snapshot->procs = values[10];
+	snapshot->users = values[11];
+}
+
+
+/* snapshot_decode_data */
+static int _snapshot_decode_data(Snapshot * snapshot, char const * p,
+		char const * end)
+{
+	uint32_t u32;
+	size_t i;
+	SnapshotInterface * iface;
+	SnapshotVolume * vol;
+
+	if(_snapshot_decode_uint32(&p, end, &u32) != 0)
+		return -1;
+	if(u32 == SNAPSHOT_VERSION_DELTA)
+		return _snapshot_decode_delta(snapshot, p, end);
+	if(u32 != SNAPSHOT_VERSION)
+		return error_set_code(-1, "%s%u",
+				"Unsupported snapshot version ", u32);
+	if(_snapshot_decode_uint64(&p, end, &snapshot->uptime) != 0)
+		return -1;
+	for(i = 0; i < sizeof(snapshot->load) / sizeof(*snapshot->load); i++)
+		if(_snapshot_decode_uint64(&p, end, &snapshot->load[i]) != 0)
+			return -1;
+	for(i = 0; i < sizeof(snapshot->ram) / sizeof(*snapshot->ram); i++)
+		if(_snapshot_decode_uint64(&p, end, &snapshot->ram[i]) != 0)
+			return -1;
+	for(i = 0; i < sizeof(snapshot->swap) / sizeof(*snapshot->swap); i++)
+		if(_snapshot_decode_uint64(&p, end, &snapshot->swap[i]) != 0)
+			return -1;
+	if(_snapshot_decode_uint64(&p, end, &snapshot->procs) != 0
+			|| _snapshot_decode_uint64(&p, end, &snapshot->users)
+			!= 0)
+		return -1;
+	/* interfaces */
+	if(_snapshot_decode_uint32(&p, end, &u32) != 0)
+		return -1;
+	/* each interface takes at least 18 bytes */
+	if(u32 > (size_t)(end - p) / 18)
+		return error_set_code(-1, "%s", "Truncated snapshot");
+	if(snapshot_set_interfaces_count(snapshot, u32) != 0)
+		return -1;
+	for(i = 0; i < snapshot->ifaces_cnt; i++)
+	{
+		iface = &snapshot->ifaces[i];
+		if(_snapshot_decode_string(&p, end, iface->name,
+					sizeof(iface->name)) != 0
+				|| _snapshot_decode_uint64(&p, end,
+					&iface->rxbytes) != 0
+				|| _snapshot_decode_uint64(&p, end,
+					&iface->txbytes) != 0)
+			return -1;
+	}
+	/* volumes */
+	if(_snapshot_decode_uint32(&p, end, &u32) != 0)
+		return -1;
+	if(u32 > (size_t)(end - p) / 18)
+		return error_set_code(-1, "%s", "Truncated snapshot");
+	if(snapshot_set_volumes_count(snapshot, u32) != 0)
+		return -1;
+	for(i = 0; i < snapshot->vols_cnt; i++)
+	{
+		vol = &snapshot->vols[i];
+		if(_snapshot_decode_string(&p, end, vol->name,
+					sizeof(vol->name)) != 0
+				|| _snapshot_decode_uint64(&p, end, &vol->total)
+				!= 0
+				|| _snapshot_decode_uint64(&p, end, &vol->free)
+				!= 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+/* snapshot_decode_delta */
+static int _snapshot_decode_delta(Snapshot * snapshot, char const * p,
+		char const * end)
+{
+	uint32_t mask;
+	uint64_t values[SNAPSHOT_VALUES_COUNT];
+	uint32_t cnt;
+	uint32_t changed;
+	uint32_t index;
+	size_t i;
+	size_t j;
+	SnapshotInterface * iface;
+	SnapshotVolume * vol;
+
+	/* applied over the previous snapshot */
+	if(_snapshot_decode_uint32(&p, end, &mask) != 0)
+		return -1;
+	_snapshot_get_values(snapshot, values);
+	for(i = 0; i < SNAPSHOT_VALUES_COUNT; i++)
+		if((mask & (1 << i))
+				&& _snapshot_decode_uint64(&p, end, &values[i])
+				!= 0)
+			return -1;
+	_snapshot_set_values(snapshot, values);
+	/* interfaces */
+	if(_snapshot_decode_uint32(&p, end, &cnt) != 0
+			|| _snapshot_decode_uint32(&p, end, &changed) != 0)
+		return -1;
+	/* each interface changed takes at least 22 bytes */
+	if(changed > cnt || changed > (size_t)(end - p) / 22)
+		return error_set_code(-1, "%s", "Truncated snapshot");
+	j = snapshot->ifaces_cnt;
+	if(snapshot_set_interfaces_count(snapshot, cnt) != 0)
+		return -1;
+	for(; j < cnt; j++)
+		memset(&snapshot->ifaces[j], 0, sizeof(*snapshot->ifaces));
+	for(i = 0; i < changed; i++)
+	{
+		if(_snapshot_decode_uint32(&p, end, &index) != 0)
+			return -1;
+		if(index >= cnt)
+			return error_set_code(-1, "%s", "Invalid snapshot");
+		iface = &snapshot->ifaces[index];
+		if(_snapshot_decode_string(&p, end, iface->name,
+					sizeof(iface->name)) != 0
+				|| _snapshot_decode_uint64(&p, end,
+					&iface->rxbytes) != 0
+				|| _snapshot_decode_uint64(&p, end,
+					&iface->txbytes) != 0)
+			return -1;
+	}
+	/* volumes */
+	if(_snapshot_decode_uint32(&p, end, &cnt) != 0
+			|| _snapshot_decode_uint32(&p, end, &changed) != 0)
+		return -1;
+	if(changed > cnt || changed > (size_t)(end - p) / 22)
+		return error_set_code(-1, "%s", "Truncated snapshot");
+	j = snapshot->vols_cnt;
+	if(snapshot_set_volumes_count(snapshot, cnt) != 0)
+		return -1;
+	for(; j < cnt; j++)
+		memset(&snapshot->vols[j], 0, sizeof(*snapshot->vols));
+	for(i = 0; i < changed; i++)
+	{
+		if(_snapshot_decode_uint32(&p, end, &index) != 0)
+			return -1;
+		if(index >= cnt)
+			return error_set_code(-1, "%s", "Invalid snapshot");
+		vol = &snapshot->vols[index];
+		if(_snapshot_decode_string(&p, end, vol->name,
+					sizeof(vol->name)) != 0
+				|| _snapshot_decode_uint64(&p, end, &vol->total)
+				!= 0
+				|| _snapshot_decode_uint64(&p, end, &vol->free)
+				!= 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+/* snapshot_decode_string */
+static int _snapshot_decode_string(char const ** p, char const * end,
+		char * string, size_t size)
+{
+	uint16_t len;
+
+	if(_snapshot_decode_uint16(p, end, &len) != 0)
+		return -1;
+	if(len >= size || len > end - *p)
+		return error_set_code(-1, "%s", "Invalid snapshot");
+	memcpy(string, *p, len);
+	string[len] = '\0';
+	*p += len;
+	return 0;
+}
+
+
+/* snapshot_decode_uint16 */
+static int _snapshot_decode_uint16(char const ** p, char const * end,
+		uint16_t * value)
+{
+	unsigned char const * u = (unsigned char const *)*p;
+
+	if(end - *p < 2)
+		return error_set_code(-1, "%s", "Truncated snapshot");
+	*value = (u[0] << 8) | u[1];
+	*p += 2;
+	return 0;
+}
+
+
+/* snapshot_decode_uint32 */
+static int _snapshot_decode_uint32(char const ** p, char const * end,
+		uint32_t * value)
+{
+	unsigned char const * u = (unsigned char const *)*p;
+
+	if(end - *p < 4)
+		return error_set_code(-1, "%s", "Truncated snapshot");
+	*value = ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16)
+		| ((uint32_t)u[2] << 8) | u[3];
+	*p += 4;
+	return 0;
+}
+
+
+/* snapshot_decode_uint64 */
+static int _snapshot_decode_uint64(char const ** p, char const * end,
+		uint64_t * value)
+{
+	uint32_t high;
+	uint32_t low;
+
+	if(_snapshot_decode_uint32(p, end, &high) != 0
+			|| _snapshot_decode_uint32(p, end, &low) != 0)
+		return -1;
+	*value = ((uint64_t)high << 32) | low;
+	return 0;
+}
+
+
+/* snapshot_encode_string */
+static void _snapshot_encode_string(char ** p, char const * string)
+{
+	size_t len;
+
+	len = strlen(string);
+	_snapshot_encode_uint16(p, len);
+	memcpy(*p, string, len);
+	*p += len;
+}
+
+
+/* snapshot_encode_uint16 */
+static void _snapshot_encode_uint16(char ** p, uint16_t value)
+{
+	unsigned char * u = (unsigned char *)*p;
+
+	u[0] = value >> 8;
+	u[1] = value & 0xff;
+	*p += 2;
+}
+
+
+/* snapshot_encode_uint32 */
+static void _snapshot_encode_uint32(char ** p, uint32_t value)
+{
+	unsigned char * u = (unsigned char *)*p;
+
+	u[0] = value >> 24;
+	u[1] = (value >> 16) & 0xff;
+	u[2] = (value >> 8) & 0xff;
+	u[3] = value & 0xff;
+	*p += 4;
+}
+
+
+/* snapshot_encode_uint64 */
+static void _snapshot_encode_uint64(char ** p, uint64_t value)
+{
+	_snapshot_encode_uint32(p, value >> 32);
+	_snapshot_encode_uint32(p, value & 0xffffffff);
+}
@@ -0,0 +1,112 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#ifndef PROBE_SNAPSHOT_H
+# define PROBE_SNAPSHOT_H
+
+# include <stdint.h>
+# include <time.h>
+# include <System.h>
+
+
+/* Snapshot */
+/* constants */
+# define SNAPSHOT_VERSION	1
+# define SNAPSHOT_VERSION_DELTA	2
+# define SNAPSHOT_VERSION_SUMMARY	3
+
+/* uptime, loads, RAM, swap, processes and users */
+# define SNAPSHOT_VALUES_COUNT	12
+
+/* including the terminating NUL character */
+# define SNAPSHOT_INTERFACE_NAME	32
+# define SNAPSHOT_VOLUME_NAME	256
+
+
+/* types */
+typedef struct _SnapshotInterface
+{
+	char name[SNAPSHOT_INTERFACE_NAME];
+	uint64_t rxbytes;
+	uint64_t txbytes;
+} SnapshotInterface;
+
+typedef struct _SnapshotVolume
+{
+	char name[SNAPSHOT_VOLUME_NAME];
+	uint64_t total;				/* in kilobytes */
+	uint64_t free;				/* in kilobytes */
+} SnapshotVolume;
+
+typedef struct _Snapshot
+{
+	uint64_t uptime;
+	uint64_t load[3];
+	uint64_t ram[4];			/* total, free, shared, buffer */
+	uint64_t swap[2];			/* total, free */
+	uint64_t procs;
+	uint64_t users;
+	SnapshotInterface * ifaces;
+	size_t ifaces_cnt;
+	SnapshotVolume * vols;
+	size_t vols_cnt;
+} Snapshot;
+
+typedef struct _SnapshotSummary
+{
+	uint32_t count;				/* snapshots summarized */
+	uint64_t min[SNAPSHOT_VALUES_COUNT];
+	uint64_t max[SNAPSHOT_VALUES_COUNT];
+	uint64_t sum[SNAPSHOT_VALUES_COUNT];
+	uint64_t last[SNAPSHOT_VALUES_COUNT];
+} SnapshotSummary;
+
+
+/* functions */
+Snapshot * snapshot_new(void);
+void snapshot_delete(Snapshot * snapshot);
+
+/* accessors */
+SnapshotInterface * snapshot_get_interface(Snapshot * snapshot,
+		char const * name);
+SnapshotVolume * snapshot_get_volume(Snapshot * snapshot, char const * name);
+
+int snapshot_set_interface_name(Snapshot * snapshot, size_t i,
+		char const * name);
+int snapshot_set_interfaces_count(Snapshot * snapshot, size_t count);
+int snapshot_set_volume_name(Snapshot * snapshot, size_t i,
+		char const * name);
+int snapshot_set_volumes_count(Snapshot * snapshot, size_t count);
+
+/* useful */
+int snapshot_decode(Snapshot * snapshot, Buffer const * buffer);
+int snapshot_encode(Snapshot const * snapshot, Buffer * buffer);
+int snapshot_encode_delta(Snapshot const * snapshot, Snapshot const * base,
+		Buffer * buffer);
+
+int snapshot_history_append(Buffer * buffer, uint32_t seq, time_t timestamp,
+		Snapshot const * snapshot, Snapshot const * base);
+int snapshot_history_decode(Buffer const * buffer, size_t * offset,
+		uint32_t * seq, time_t * timestamp, Snapshot * snapshot);
+
+void snapshot_summary_reset(SnapshotSummary * summary);
+int snapshot_summary_decode(SnapshotSummary * summary, Buffer const * buffer);
+int snapshot_summary_encode(SnapshotSummary const * summary, Buffer * buffer);
+void snapshot_summary_update(SnapshotSummary * summary,
+		Snapshot const * snapshot);
+
+#endif /* !PROBE_SNAPSHOT_H */
@@ -0,0 +1,771 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* Every series is kept as a directory of chunks named after their first
+ * timestamp, each covering a fixed period of time ("first.chunk"):
+ * - magic ("DaMonChk")
+ * - version (32 bits)
+ * - number of values per point (32 bits)
+ * - number of points (32 bits)
+ * - first timestamp (64 bits)
+ * - for the timestamps, then for every value: the length of the column (in
+ *   bits, 32 bits) followed by its bits, padded to the next byte
+ * Integers are big-endian. The columns are compressed like in Facebook's
+ * Gorilla:
+ * - timestamps: the first delta on 32 bits, then the delta of deltas as '0'
+ *   (0), '10' and 7 bits, '110' and 9 bits, '1110' and 12 bits, or '1111'
+ *   and 32 bits
+ * - values: the first value on 64 bits, then XOR'ed with the previous one as
+ *   '0' (same value), '10' and the meaningful bits within the previous
+ *   window, or '11', the leading zeros (5 bits), the number of meaningful
+ *   bits (6 bits, 0 meaning 64) and the meaningful bits
+ * Until complete, the points of a chunk are also appended to a journal as
+ * they come ("first.open"), replayed if DaMon did not get to write the
+ * chunk itself:
+ * - magic ("DaMonJnl")
+ * - version (32 bits)
+ * - number of values per point (32 bits)
+ * - for every point: the timestamp (64 bits) then the values (64 bits) */
+
+
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <System.h>
+#include "store.h"
+#include "table.h"
+
+#ifndef PROGNAME_DAMON
+# define PROGNAME_DAMON		"DaMon"
+#endif
+
+
+/* Store */
+/* private */
+/* types */
+typedef struct _StoreColumn
+{
+	unsigned char * data;
+	size_t size;				/* in bytes */
+	size_t bits;				/* written so far */
+	uint64_t value;				/* previous value */
+	unsigned int leading;
+	unsigned int trailing;			/* 64 without a window */
+} StoreColumn;
+
+typedef struct _StoreSeries
+{
+	String * name;
+	String * path;				/* directory of the chunks */
+	int fd;					/* journal of the chunk */
+	size_t count;				/* points in the current chunk */
+	int64_t first;
+	int64_t last;
+	int64_t delta;
+	size_t values_cnt;
+	StoreColumn columns[1 + STORE_VALUES_MAX]; /* timestamps first */
+} StoreSeries;
+
+struct _Store
+{
+	String * directory;
+	unsigned int chunk;
+	unsigned int retention;
+
+	/* series indexed by name */
+	Table * series;
+};
+
+
+/* constants */
+#define STORE_MAGIC		"DaMonChk"
+#define STORE_MAGIC_JOURNAL	"DaMonJnl"
+#define STORE_VERSION		1
+
+
+/* prototypes */
+static int _store_column_write(StoreColumn * column, uint64_t value,
+		unsigned int bits);
+static int _store_column_write_delta(StoreColumn * column, int64_t dod);
+static int _store_column_write_value(StoreColumn * column, uint64_t value);
+
+static StoreSeries * _store_series_get(Store * store, char const * name);
+static int _store_series_add(Store * store, StoreSeries * series, int64_t t,
+		uint64_t const * values, size_t values_cnt);
+static int _store_series_expire(Store * store, StoreSeries * series);
+static int _store_series_flush(Store * store, StoreSeries * series);
+static int _store_series_journal(StoreSeries * series, int64_t t,
+		uint64_t const * values);
+static int _store_series_recover(Store * store, StoreSeries * series);
+static char const * _store_series_key(void const * entry);
+
+static int _store_mkdir(char const * path);
+
+
+/* public */
+/* functions */
+/* store_new */
+Store * store_new(char const * directory, unsigned int chunk,
+		unsigned int retention)
+{
+	Store * store;
+
+	if(chunk == 0)
+	{
+		error_set_code(-EINVAL, "%s", strerror(EINVAL));
+		return NULL;
+	}
+	if((store = object_new(sizeof(*store))) == NULL)
+		return NULL;
+	store->directory = string_new(directory);
+	store->chunk = chunk;
+	store->retention = retention;
+	store->series = table_new(_store_series_key);
+	if(store->directory == NULL || store->series == NULL)
+	{
+		if(store->series != NULL)
+			table_delete(store->series);
+		string_delete(store->directory);
+		object_delete(store);
+		return NULL;
+	}
+	return store;
+}
+
+
+/* store_delete */
+void store_delete(Store * store)
+{
+	size_t i;
+	size_t j;
+	StoreSeries * series;
+
+	if(store_flush(store) != 0)
+		error_print(PROGNAME_DAMON);
+	for(i = 0; (series = table_get_next(store->series, &i)) != NULL;)
+	{
+		if(series->fd >= 0)
+			close(series->fd);
+		string_delete(series->name);
+		string_delete(series->path);
+		for(j = 0; j < sizeof(series->columns)
+				/ sizeof(*series->columns); j++)
+			free(series->columns[j].data);
+		object_delete(series);
+	}
+	table_delete(store->series);
+	string_delete(store->directory);
+	object_delete(store);
+}
+
+
+/* useful */
+/* store_append */
+int store_append(Store * store, char const * name, time_t timestamp,
+		uint64_t const * values, size_t values_cnt)
+{
+	int ret;
+	StoreSeries * series;
+	int64_t t = timestamp;
+
+	if(values_cnt == 0 || values_cnt > STORE_VALUES_MAX)
+		return error_set_code(-EINVAL, "%s: %s", name,
+				strerror(EINVAL));
+	if((series = _store_series_get(store, name)) == NULL)
+		return -1;
+	if(series->count > 0 && t <= series->last)
+		return error_set_code(1, "%s: %lld: %s", name, (long long)t,
+				"Illegal update time");
+	ret = _store_series_add(store, series, t, values, values_cnt);
+	/* on disk right away, in case DaMon does not get to flush */
+	if(series->count > 0 && series->last == t
+			&& _store_series_journal(series, t, values) != 0)
+		ret = -1;
+	return ret;
+}
+
+
+/* store_flush */
+int store_flush(Store * store)
+{
+	int ret = 0;
+	size_t i;
+	StoreSeries * series;
+
+	for(i = 0; (series = table_get_next(store->series, &i)) != NULL;)
+		if(_store_series_flush(store, series) != 0)
+			ret = -1;
+	return ret;
+}
+
+
+/* private */
+/* functions */
+/* store_column_write */
+static int _store_column_write(StoreColumn * column, uint64_t value,
+		unsigned int bits)
+{
+	unsigned char * p;
+	size_t size;
+	unsigned int n;
+	unsigned int offset;
+
+	if(column->bits + bits > column->size * 8)
+	{
+		size = (column->size > 0) ? column->size * 2 : 64;
+		if((p = realloc(column->data, size)) == NULL)
+			return error_set_code(-errno, "%s", strerror(errno));
+		memset(&p[column->size], 0, size - column->size);
+		column->data = p;
+		column->size = size;
+	}
+	/* most significant bits first */
+	while(bits > 0)
+	{
+		offset = column->bits % 8;
+		n = (8 - offset < bits) ? 8 - offset : bits;
+		column->data[column->bits / 8] |= ((value >> (bits - n))
+				& ((1u << n) - 1)) << (8 - offset - n);
+		column->bits += n;
+		bits -= n;
+	}
+	return 0;
+}
+
+
+/* store_column_write_delta */
+static int _store_column_write_delta(StoreColumn * column, int64_t dod)
+{
+	if(dod == 0)
+		return _store_column_write(column, 0x0, 1);
+	if(dod >= -64 && dod <= 63)
+		return (_store_column_write(column, 0x2, 2) == 0
+				&& _store_column_write(column, dod & 0x7f, 7)
+				== 0) ? 0 : -1;
+	if(dod >= -256 && dod <= 255)
+		return (_store_column_write(column, 0x6, 3) == 0
+				&& _store_column_write(column, dod & 0x1ff, 9)
+				== 0) ? 0 : -1;
+	if(dod >= -2048 && dod <= 2047)
+		return (_store_column_write(column, 0xe, 4) == 0
+				&& _store_column_write(column, dod & 0xfff, 12)
+				== 0) ? 0 : -1;
+	return (_store_column_write(column, 0xf, 4) == 0
+			&& _store_column_write(column, dod & 0xffffffff, 32)
+			== 0) ? 0 : -1;
+}
+
+
+/* store_column_write_value */
+static int _store_column_write_value(StoreColumn * column, uint64_t value)
+{
+	uint64_t x = value ^ column->value;
+	unsigned int leading;
+	unsigned int trailing;
+	unsigned int meaningful;
+
+	column->value = value;
+	if(x == 0)
+		return _store_column_write(column, 0x0, 1);
+	for(leading = 0; (x & (0x8000000000000000ull >> leading)) == 0;
+			leading++);
+	for(trailing = 0; (x & (0x1ull << trailing)) == 0; trailing++);
+	/* the leading zeros are stored on 5 bits */
+	if(leading > 31)
+		leading = 31;
+	if(column->trailing < 64 && leading >= column->leading
+			&& trailing >= column->trailing)
+	{
+		/* re-use the previous window */
+		meaningful = 64 - column->leading - column->trailing;
+		return (_store_column_write(column, 0x2, 2) == 0
+				&& _store_column_write(column,
+					x >> column->trailing, meaningful)
+				== 0) ? 0 : -1;
+	}
+	column->leading = leading;
+	column->trailing = trailing;
+	meaningful = 64 - leading - trailing;
+	return (_store_column_write(column, 0x3, 2) == 0
+			&& _store_column_write(column, leading, 5) == 0
+			&& _store_column_write(column, meaningful & 0x3f, 6)
+			== 0
+			&& _store_column_write(column, x >> trailing,
+				meaningful) == 0) ? 0 : -1;
+}
+
+
+/* store_series_get */
+static StoreSeries * _store_series_get(Store * store, char const * name)
+{
+	StoreSeries * series;
+	size_t i;
+	char const * q;
+
+	if((series = table_get(store->series, name)) != NULL)
+		return series;
+	if((series = object_new(sizeof(*series))) == NULL)
+		return NULL;
+	memset(series, 0, sizeof(*series));
+	series->fd = -1;
+	/* the chunks go in a directory named after the series */
+	if((q = strrchr(name, '.')) == NULL || strchr(q, '/') != NULL)
+		q = &name[strlen(name)];
+	if((series->name = string_new(name)) == NULL
+			|| (series->path = string_new_append(store->directory,
+					"/", name, NULL)) == NULL
+			|| table_add(store->series, series) != 0)
+	{
+		string_delete(series->name);
+		string_delete(series->path);
+		object_delete(series);
+		return NULL;
+	}
+	series->path[string_get_length(store->directory) + 1 + (q - name)]
+		= '\0';
+	for(i = 0; i < sizeof(series->columns) / sizeof(*series->columns);
+			i++)
+		series->columns[i].trailing = 64;
+	/* left over by a previous run */
+	if(_store_series_recover(store, series) != 0)
+		error_print(PROGNAME_DAMON);
+	return series;
+}
+
+static char const * _store_series_key(void const * entry)
+{
+	StoreSeries const * series = entry;
+
+	return series->name;
+}
+
+
+/* store_series_add */
+static int _store_series_add(Store * store, StoreSeries * series, int64_t t,
+		uint64_t const * values, size_t values_cnt)
+{
+	int ret = 0;
+	int64_t delta;
+	size_t i;
+
+	/* start a new chunk when needed */
+	if(series->count > 0 && (t / store->chunk
+				!= series->first / store->chunk
+				|| values_cnt != series->values_cnt))
+		ret = _store_series_flush(store, series);
+	if(series->count == 0)
+	{
+		series->first = t;
+		series->delta = 0;
+		series->values_cnt = values_cnt;
+		for(i = 0; i < values_cnt; i++)
+		{
+			if(_store_column_write(&series->columns[1 + i],
+						values[i], 64) != 0)
+				return -1;
+			series->columns[1 + i].value = values[i];
+		}
+	}
+	else
+	{
+		delta = t - series->last;
+		if(series->count == 1)
+		{
+			if(_store_column_write(&series->columns[0], delta, 32)
+					!= 0)
+				return -1;
+		}
+		else if(_store_column_write_delta(&series->columns[0],
+					delta - series->delta) != 0)
+			return -1;
+		series->delta = delta;
+		for(i = 0; i < values_cnt; i++)
+			if(_store_column_write_value(&series->columns[1 + i],
+						values[i]) != 0)
+				return -1;
+	}
+	series->last = t;
+	series->count++;
+	return ret;
+}
+
+
+/* store_series_expire */
+static int _store_series_expire(Store * store, StoreSeries * series)
+{
+	DIR * dir;
+	struct dirent * de;
+	long long first;
+	int len;
+	String * filename;
+
+	if((dir = opendir(series->path)) == NULL)
+		return error_set_code(-errno, "%s: %s", series->path,
+				strerror(errno));
+	while((de = readdir(dir)) != NULL)
+	{
+		/* only "<digits>.chunk" exactly */
+		len = 0;
+		if(de->d_name[0] < '0' || de->d_name[0] > '9'
+				|| sscanf(de->d_name, "%lld.chunk%n", &first,
+					&len) != 1 || len == 0
+				|| de->d_name[len] != '\0'
+				|| first + store->chunk + store->retention
+				>= series->first)
+			continue;
+		if((filename = string_new_append(series->path, "/",
+						de->d_name, NULL)) == NULL)
+			break;
+		if(unlink(filename) != 0)
+			error_set_print(PROGNAME_DAMON, -errno, "%s: %s",
+					filename, strerror(errno));
+		string_delete(filename);
+	}
+	closedir(dir);
+	return 0;
+}
+
+
+/* store_series_flush */
+static int _series_flush_write(FILE * fp, void const * data, size_t size);
+
+static int _store_series_flush(Store * store, StoreSeries * series)
+{
+	int ret = 0;
+	String * filename;
+	String * tmp;
+	FILE * fp;
+	unsigned char buf[8];
+	uint64_t u;
+	size_t i;
+	size_t j;
+
+	if(series->count == 0)
+		return 0;
+	if((filename = string_new_format("%s/%lld.chunk", series->path,
+					(long long)series->first)) == NULL
+			|| (tmp = string_new_append(filename, ".tmp", NULL))
+			== NULL)
+	{
+		string_delete(filename);
+		return -1;
+	}
+	if(_store_mkdir(series->path) != 0
+			|| (fp = fopen(tmp, "w")) == NULL)
+		ret = error_set_code(-errno, "%s: %s", tmp, strerror(errno));
+	else
+	{
+		ret = _series_flush_write(fp, STORE_MAGIC, 8);
+		u = ((uint64_t)STORE_VERSION << 32) | series->values_cnt;
+		for(i = 0; i < 8; i++)
+			buf[i] = u >> (56 - i * 8);
+		ret |= _series_flush_write(fp, buf, 8);
+		for(i = 0; i < 4; i++)
+			buf[i] = series->count >> (24 - i * 8);
+		ret |= _series_flush_write(fp, buf, 4);
+		for(i = 0; i < 8; i++)
+			buf[i] = (uint64_t)series->first >> (56 - i * 8);
+		ret |= _series_flush_write(fp, buf, 8);
+		for(i = 0; i <= series->values_cnt; i++)
+		{
+			for(j = 0; j < 4; j++)
+				buf[j] = series->columns[i].bits >> (24 - j * 8);
+			ret |= _series_flush_write(fp, buf, 4);
+			ret |= _series_flush_write(fp, series->columns[i].data,
+					(series->columns[i].bits + 7) / 8);
+		}
+		if(fclose(fp) != 0 || ret != 0 || rename(tmp, filename) != 0)
+		{
+			ret = error_set_code(-errno, "%s: %s", filename,
+					strerror(errno));
+			unlink(tmp);
+		}
+	}
+	string_delete(tmp);
+	string_delete(filename);
+	/* the journal is only needed until the chunk is written */
+	if(series->fd >= 0)
+		close(series->fd);
+	series->fd = -1;
+	if(ret == 0 && (filename = string_new_format("%s/%lld.open",
+					series->path, (long long)series->first))
+			!= NULL)
+	{
+		unlink(filename);
+		string_delete(filename);
+	}
+	/* start over in any case */
+	for(i = 0; i < sizeof(series->columns) / sizeof(*series->columns);
+			i++)
+	{
+		if(series->columns[i].data != NULL)
+			memset(series->columns[i].data, 0,
+					(series->columns[i].bits + 7) / 8);
+		series->columns[i].bits = 0;
+		series->columns[i].value = 0;
+		series->columns[i].leading = 0;
+		series->columns[i].trailing = 64;
+	}
+	series->count = 0;
+	if(ret == 0 && store->retention > 0)
+		ret = _store_series_expire(store, series);
+	return ret;
+}
+
+static int _series_flush_write(FILE * fp, void const * data, size_t size)
+{
+	if(size == 0 || fwrite(data, 1, size, fp) == size)
+		return 0;
+	if(errno == 0)
+		errno = EIO;
+	return -1;
+}
+
+
+/* store_series_journal */
+static int _store_series_journal(StoreSeries * series, int64_t t,
+		uint64_t const * values)
+{
+	String * filename;
+	unsigned char buf[8 * (1 + STORE_VALUES_MAX)];
+	uint64_t u;
+	size_t size;
+	size_t i;
+	size_t j;
+
+	/* only from the first point of the chunk on */
+	if(series->fd < 0 && series->count != 1)
+		return 0;
+	if(series->fd < 0)
+	{
+		if((filename = string_new_format("%s/%lld.open", series->path,
+						(long long)series->first))
+				== NULL)
+			return -1;
+		if(_store_mkdir(series->path) != 0
+				|| (series->fd = open(filename, O_WRONLY
+						| O_CREAT | O_TRUNC | O_APPEND,
+						0666)) < 0)
+		{
+			error_set_code(-errno, "%s: %s", filename,
+					strerror(errno));
+			string_delete(filename);
+			return -1;
+		}
+		string_delete(filename);
+		memcpy(buf, STORE_MAGIC_JOURNAL, 8);
+		u = ((uint64_t)STORE_VERSION << 32) | series->values_cnt;
+		for(i = 0; i < 8; i++)
+			buf[8 + i] = u >> (56 - i * 8);
+		if(write(series->fd, buf, 16) != 16)
+			goto error;
+	}
+	for(i = 0; i < 8; i++)
+		buf[i] = (uint64_t)t >> (56 - i * 8);
+	for(j = 0; j < series->values_cnt; j++)
+		for(i = 0; i < 8; i++)
+			buf[8 + j * 8 + i] = values[j] >> (56 - i * 8);
+	size = 8 * (1 + series->values_cnt);
+	if(write(series->fd, buf, size) == (ssize_t)size)
+		return 0;
+error:
+	if(errno == 0)
+		errno = EIO;
+	error_set_code(-errno, "%s: %s", series->path, strerror(errno));
+	/* until the next chunk */
+	close(series->fd);
+	series->fd = -1;
+	return -1;
+}
+
+
+/* store_series_recover */
+static int _recover_compare(void const * a, void const * b);
+static int _recover_journal(Store * store, StoreSeries * series,
+		long long first, int last);
+
+static int _store_series_recover(Store * store, StoreSeries * series)
+{
+	int ret = 0;
+	DIR * dir;
+	struct dirent * de;
+	long long first;
+	long long * firsts = NULL;
+	long long * p;
+	size_t cnt = 0;
+	size_t i;
+	int len;
+
+	if((dir = opendir(series->path)) == NULL)
+		return (errno == ENOENT) ? 0 : error_set_code(-errno, "%s: %s",
+				series->path, strerror(errno));
+	while((de = readdir(dir)) != NULL)
+	{
+		/* only "<digits>.open" exactly */
+		len = 0;
+		if(de->d_name[0] < '0' || de->d_name[0] > '9'
+				|| sscanf(de->d_name, "%lld.open%n", &first,
+					&len) != 1 || len == 0
+				|| de->d_name[len] != '\0')
+			continue;
+		if((p = realloc(firsts, sizeof(*p) * (cnt + 1))) == NULL)
+		{
+			ret = error_set_code(-errno, "%s", strerror(errno));
+			break;
+		}
+		firsts = p;
+		firsts[cnt++] = first;
+	}
+	closedir(dir);
+	/* oldest first, only the last one is continued */
+	if(cnt > 0)
+		qsort(firsts, cnt, sizeof(*firsts), _recover_compare);
+	for(i = 0; ret == 0 && i < cnt; i++)
+		ret = _recover_journal(store, series, firsts[i], i + 1 == cnt);
+	free(firsts);
+	return ret;
+}
+
+static int _recover_compare(void const * a, void const * b)
+{
+	long long const * la = a;
+	long long const * lb = b;
+
+	return (*la > *lb) - (*la < *lb);
+}
+
+static int _recover_journal(Store * store, StoreSeries * series,
+		long long first, int last)
+{
+	int ret = 0;
+	String * filename;
+	String * chunk;
+	FILE * fp;
+	unsigned char buf[8 * (1 + STORE_VALUES_MAX)];
+	uint64_t u;
+	int64_t t;
+	uint64_t values[STORE_VALUES_MAX];
+	size_t values_cnt;
+	long size = 0;
+	size_t i;
+	size_t j;
+
+	if((filename = string_new_format("%s/%lld.open", series->path, first))
+			== NULL)
+		return -1;
+	/* the chunk may have been written already */
+	if((chunk = string_new_format("%s/%lld.chunk", series->path, first))
+			!= NULL && access(chunk, F_OK) == 0)
+	{
+		unlink(filename);
+		string_delete(chunk);
+		string_delete(filename);
+		return 0;
+	}
+	string_delete(chunk);
+	if((fp = fopen(filename, "r")) == NULL)
+	{
+		ret = error_set_code(-errno, "%s: %s", filename,
+				strerror(errno));
+		string_delete(filename);
+		return ret;
+	}
+	if(fread(buf, 1, 16, fp) != 16 || memcmp(buf, STORE_MAGIC_JOURNAL, 8)
+			!= 0)
+		values_cnt = 0;
+	else
+	{
+		for(i = 0, u = 0; i < 8; i++)
+			u = (u << 8) | buf[8 + i];
+		values_cnt = ((u >> 32) == STORE_VERSION) ? u & 0xffffffff
+			: 0;
+	}
+	if(values_cnt == 0 || values_cnt > STORE_VALUES_MAX)
+		ret = error_set_code(1, "%s: %s", filename, "Invalid journal");
+	else
+		for(size = 16; fread(buf, 1, 8 * (1 + values_cnt), fp)
+				== 8 * (1 + values_cnt);
+				size += 8 * (1 + values_cnt))
+		{
+			/* a point cut short is left out */
+			for(i = 0, u = 0; i < 8; i++)
+				u = (u << 8) | buf[i];
+			t = u;
+			for(j = 0; j < values_cnt; j++)
+				for(i = 0, values[j] = 0; i < 8; i++)
+					values[j] = (values[j] << 8)
+						| buf[8 + j * 8 + i];
+			if((series->count > 0 && t <= series->last)
+					|| _store_series_add(store, series, t,
+						values, values_cnt) < 0)
+				break;
+		}
+	fclose(fp);
+	if(ret != 0)
+	{
+		/* kept for inspection */
+		if((chunk = string_new_append(filename, ".bad", NULL)) != NULL)
+			rename(filename, chunk);
+		string_delete(chunk);
+	}
+	else if(series->count == 0)
+		unlink(filename);
+	else if(!last || series->first != first)
+		ret = _store_series_flush(store, series);
+	/* carry on with the chunk, past its last complete point */
+	else if((series->fd = open(filename, O_WRONLY | O_APPEND)) < 0
+			|| ftruncate(series->fd, size) != 0)
+	{
+		ret = error_set_code(-errno, "%s: %s", filename,
+				strerror(errno));
+		if(series->fd >= 0)
+			close(series->fd);
+		series->fd = -1;
+	}
+	string_delete(filename);
+	return ret;
+}
+
+
+/* store_mkdir */
+static int _store_mkdir(char const * path)
+{
+	int ret = 0;
+	char * p;
+	size_t i;
+
+	if((p = strdup(path)) == NULL)
+		return -1;
+	for(i = 1; p[i] != '\0'; i++)
+	{
+		if(p[i] != '/')
+			continue;
+		p[i] = '\0';
+		if(mkdir(p, 0777) != 0 && errno != EEXIST)
+			ret = -1;
+		p[i] = '/';
+		if(ret != 0)
+			break;
+	}
+	if(ret == 0 && mkdir(p, 0777) != 0 && errno != EEXIST)
+		ret = -1;
+	free(p);
+	return ret;
+}
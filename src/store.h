@@ -0,0 +1,45 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#ifndef DAMON_STORE_H
+# define DAMON_STORE_H
+
+# include <stdint.h>
+# include <time.h>
+# include <System.h>
+
+
+/* Store */
+/* constants */
+# define STORE_VALUES_MAX	4
+
+
+/* types */
+typedef struct _Store Store;
+
+
+/* functions */
+Store * store_new(char const * directory, unsigned int chunk,
+		unsigned int retention);
+void store_delete(Store * store);
+
+/* useful */
+int store_append(Store * store, char const * name, time_t timestamp,
+		uint64_t const * values, size_t values_cnt);
+int store_flush(Store * store);
+
+#endif /* !DAMON_STORE_H */
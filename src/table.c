@@ -0,0 +1,203 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+/* Open addressing with linear probing, kept at most half full. Removals
+ * shift the rest of the cluster back, so that no tombstone is needed. */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <System.h>
+#include "table.h"
+
+
+/* Table */
+/* private */
+/* types */
+struct _Table
+{
+	TableKeyFunc key;
+	void ** slots;
+	size_t size;
+	size_t count;
+};
+
+
+/* prototypes */
+static int _table_grow(Table * table);
+
+
+/* public */
+/* functions */
+/* table_new */
+Table * table_new(TableKeyFunc key)
+{
+	Table * table;
+
+	if((table = object_new(sizeof(*table))) == NULL)
+		return NULL;
+	table->key = key;
+	table->slots = NULL;
+	table->size = 0;
+	table->count = 0;
+	return table;
+}
+
+
+/* table_delete */
+void table_delete(Table * table)
+{
+	free(table->slots);
+	object_delete(table);
+}
+
+
+/* accessors */
+/* table_get_count */
+size_t table_get_count(Table const * table)
+{
+	return table->count;
+}
+
+
+/* table_get */
+void * table_get(Table const * table, char const * name)
+{
+	size_t i;
+
+	if(table->count == 0)
+		return NULL;
+	for(i = table_hash(name) % table->size; table->slots[i] != NULL;
+			i = (i + 1) % table->size)
+		if(strcmp(table->key(table->slots[i]), name) == 0)
+			return table->slots[i];
+	return NULL;
+}
+
+
+/* table_get_next */
+void * table_get_next(Table const * table, size_t * pos)
+{
+	for(; *pos < table->size; (*pos)++)
+		if(table->slots[*pos] != NULL)
+			return table->slots[(*pos)++];
+	return NULL;
+}
+
+
+/* useful */
+/* table_add */
+int table_add(Table * table, void * entry)
+{
+	size_t i;
+
+	/* the name must not be in the table yet */
+	if((table->count + 1) * 2 > table->size && _table_grow(table) != 0)
+		return -1;
+	for(i = table_hash(table->key(entry)) % table->size;
+			table->slots[i] != NULL; i = (i + 1) % table->size);
+	table->slots[i] = entry;
+	table->count++;
+	return 0;
+}
+
+
+/* table_clear */
+void table_clear(Table * table)
+{
+	size_t i;
+
+	for(i = 0; i < table->size; i++)
+		table->slots[i] = NULL;
+	table->count = 0;
+}
+
+
+/* table_remove */
+void * table_remove(Table * table, char const * name)
+{
+	void * ret;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	if(table->count == 0)
+		return NULL;
+	for(i = table_hash(name) % table->size; table->slots[i] != NULL;
+			i = (i + 1) % table->size)
+		if(strcmp(table->key(table->slots[i]), name) == 0)
+			break;
+	if((ret = table->slots[i]) == NULL)
+		return NULL;
+	table->slots[i] = NULL;
+	table->count--;
+	/* move the rest of the cluster back within reach */
+	for(j = (i + 1) % table->size; table->slots[j] != NULL;
+			j = (j + 1) % table->size)
+	{
+		k = table_hash(table->key(table->slots[j])) % table->size;
+		if((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		table->slots[i] = table->slots[j];
+		table->slots[j] = NULL;
+		i = j;
+	}
+	return ret;
+}
+
+
+/* table_hash */
+size_t table_hash(char const * string)
+{
+	/* FNV-1a */
+	size_t ret = 2166136261u;
+	unsigned char const * p;
+
+	for(p = (unsigned char const *)string; *p != '\0'; p++)
+		ret = (ret ^ *p) * 16777619u;
+	return ret;
+}
+
+
+/* private */
+/* functions */
+/* table_grow */
+static int _table_grow(Table * table)
+{
+	void ** p;
+	size_t size;
+	size_t i;
+	size_t j;
+
+	size = (table->size > 0) ? table->size * 2 : 16;
+	if((p = calloc(size, sizeof(*p))) == NULL)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		return -1;
+	}
+	for(i = 0; i < table->size; i++)
+	{
+		if(table->slots[i] == NULL)
+			continue;
+		for(j = table_hash(table->key(table->slots[i])) % size;
+				p[j] != NULL; j = (j + 1) % size);
+		p[j] = table->slots[i];
+	}
+	free(table->slots);
+	table->slots = p;
+	table->size = size;
+	return 0;
+}
@@ -0,0 +1,49 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#ifndef PROBE_TABLE_H
+# define PROBE_TABLE_H
+
+# include <stddef.h>
+
+
+/* Table */
+/* types */
+/* entries hashed by the name they hold, never copied nor released */
+typedef struct _Table Table;
+
+typedef char const * (*TableKeyFunc)(void const * entry);
+
+
+/* functions */
+Table * table_new(TableKeyFunc key);
+void table_delete(Table * table);
+
+/* accessors */
+size_t table_get_count(Table const * table);
+void * table_get(Table const * table, char const * name);
+/* from position 0 on, NULL at the end (not while adding or removing) */
+void * table_get_next(Table const * table, size_t * pos);
+
+/* useful */
+int table_add(Table * table, void * entry);
+void table_clear(Table * table);
+void * table_remove(Table * table, char const * name);
+
+size_t table_hash(char const * string);
+
+#endif /* !PROBE_TABLE_H */
@@ -0,0 +1,265 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <System.h>
+#include "writer.h"
+
+#ifndef PROGNAME_DAMON
+# define PROGNAME_DAMON		"DaMon"
+#endif
+
+
+/* Writer */
+/* private */
+/* types */
+typedef struct _WriterEntry
+{
+	RRDSample sample;
+	char const * name;			/* in the store */
+} WriterEntry;
+
+struct _Writer
+{
+	RRD * rrd;
+	Store * store;
+	WriterPolicy policy;
+	unsigned int delay;
+
+	/* thread */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;			/* samples queued */
+	pthread_cond_t room;			/* samples written */
+	bool quit;
+
+	/* samples queued for writing */
+	WriterEntry * queue;
+	size_t queue_size;
+	size_t queue_pos;
+	size_t queue_cnt;
+	unsigned long dropped;
+};
+
+
+/* constants */
+#define WRITER_BATCH		64
+
+
+/* prototypes */
+static void * _writer_thread(void * data);
+static void _writer_write(Writer * writer, WriterEntry * entry);
+
+
+/* public */
+/* functions */
+/* writer_new */
+Writer * writer_new(RRD * rrd, Store * store, size_t queue,
+		WriterPolicy policy, unsigned int delay)
+{
+	Writer * writer;
+
+	if(queue == 0)
+	{
+		error_set_code(-EINVAL, "%s", strerror(EINVAL));
+		return NULL;
+	}
+	if((writer = object_new(sizeof(*writer))) == NULL)
+		return NULL;
+	writer->rrd = rrd;
+	writer->store = store;
+	writer->policy = policy;
+	writer->delay = delay;
+	writer->quit = false;
+	writer->queue_size = queue;
+	writer->queue_pos = 0;
+	writer->queue_cnt = 0;
+	writer->dropped = 0;
+	if((writer->queue = malloc(sizeof(*writer->queue) * queue)) == NULL)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		object_delete(writer);
+		return NULL;
+	}
+	pthread_mutex_init(&writer->mutex, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+	pthread_cond_init(&writer->room, NULL);
+	if((errno = pthread_create(&writer->thread, NULL, _writer_thread,
+					writer)) != 0)
+	{
+		error_set_code(-errno, "%s: %s", "pthread_create",
+				strerror(errno));
+		pthread_cond_destroy(&writer->room);
+		pthread_cond_destroy(&writer->cond);
+		pthread_mutex_destroy(&writer->mutex);
+		free(writer->queue);
+		object_delete(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+
+/* writer_delete */
+void writer_delete(Writer * writer)
+{
+	/* the thread writes whatever is left first */
+	pthread_mutex_lock(&writer->mutex);
+	writer->quit = true;
+	pthread_cond_broadcast(&writer->cond);
+	pthread_cond_broadcast(&writer->room);
+	pthread_mutex_unlock(&writer->mutex);
+	pthread_join(writer->thread, NULL);
+	if(writer->store != NULL)
+		store_delete(writer->store);
+	damon_rrd_delete(writer->rrd);
+	pthread_cond_destroy(&writer->room);
+	pthread_cond_destroy(&writer->cond);
+	pthread_mutex_destroy(&writer->mutex);
+	free(writer->queue);
+	object_delete(writer);
+}
+
+
+/* accessors */
+/* writer_get_dropped */
+unsigned long writer_get_dropped(Writer * writer)
+{
+	unsigned long ret;
+
+	pthread_mutex_lock(&writer->mutex);
+	ret = writer->dropped;
+	pthread_mutex_unlock(&writer->mutex);
+	return ret;
+}
+
+
+/* useful */
+/* writer_push */
+int writer_push(Writer * writer, RRDSample const * sample, char const * name)
+{
+	WriterEntry * entry;
+
+	pthread_mutex_lock(&writer->mutex);
+	if(writer->queue_cnt == writer->queue_size)
+	{
+		if(writer->policy == WRITERPOLICY_DROP)
+		{
+			writer->queue_pos = (writer->queue_pos + 1)
+				% writer->queue_size;
+			writer->queue_cnt--;
+			writer->dropped++;
+		}
+		else
+			/* slow down the caller */
+			while(writer->queue_cnt == writer->queue_size
+					&& !writer->quit)
+				pthread_cond_wait(&writer->room,
+						&writer->mutex);
+	}
+	if(writer->quit)
+	{
+		pthread_mutex_unlock(&writer->mutex);
+		return error_set_code(-EPIPE, "%s", strerror(EPIPE));
+	}
+	entry = &writer->queue[(writer->queue_pos + writer->queue_cnt)
+		% writer->queue_size];
+	entry->sample = *sample;
+	entry->name = name;
+	writer->queue_cnt++;
+	pthread_cond_signal(&writer->cond);
+	pthread_mutex_unlock(&writer->mutex);
+	return 0;
+}
+
+
+/* private */
+/* functions */
+/* writer_thread */
+static void * _writer_thread(void * data)
+{
+	Writer * writer = data;
+	WriterEntry entries[WRITER_BATCH];
+	size_t cnt;
+	size_t i;
+	time_t flushed;
+	struct timespec ts;
+
+	flushed = time(NULL);
+	pthread_mutex_lock(&writer->mutex);
+	for(;;)
+	{
+		/* write the samples buffered for too long */
+		if(writer->delay > 0 && time(NULL) >= flushed + writer->delay)
+		{
+			pthread_mutex_unlock(&writer->mutex);
+			if(damon_rrd_flush(writer->rrd) != 0)
+				error_print(PROGNAME_DAMON);
+			flushed = time(NULL);
+			pthread_mutex_lock(&writer->mutex);
+			continue;
+		}
+		if(writer->queue_cnt == 0)
+		{
+			if(writer->quit)
+				break;
+			if(writer->delay == 0)
+				pthread_cond_wait(&writer->cond, &writer->mutex);
+			else
+			{
+				ts.tv_sec = flushed + writer->delay;
+				ts.tv_nsec = 0;
+				pthread_cond_timedwait(&writer->cond,
+						&writer->mutex, &ts);
+			}
+			continue;
+		}
+		/* take a batch at once */
+		for(cnt = 0; cnt < WRITER_BATCH && writer->queue_cnt > 0;
+				cnt++)
+		{
+			entries[cnt] = writer->queue[writer->queue_pos];
+			writer->queue_pos = (writer->queue_pos + 1)
+				% writer->queue_size;
+			writer->queue_cnt--;
+		}
+		pthread_cond_broadcast(&writer->room);
+		pthread_mutex_unlock(&writer->mutex);
+		for(i = 0; i < cnt; i++)
+			_writer_write(writer, &entries[i]);
+		pthread_mutex_lock(&writer->mutex);
+	}
+	pthread_mutex_unlock(&writer->mutex);
+	return NULL;
+}
+
+
+/* writer_write */
+static void _writer_write(Writer * writer, WriterEntry * entry)
+{
+	if(damon_rrd_update(writer->rrd, &entry->sample, 1) != 0)
+		error_print(PROGNAME_DAMON);
+	if(writer->store != NULL && entry->name != NULL
+			&& store_append(writer->store, entry->name,
+				entry->sample.timestamp, entry->sample.values,
+				entry->sample.values_cnt) != 0)
+		error_print(PROGNAME_DAMON);
+}
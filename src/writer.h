@@ -0,0 +1,47 @@
+/* $Id$ */
+/* Copyright (c) 2022 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Network Probe */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#ifndef DAMON_WRITER_H
+# define DAMON_WRITER_H
+
+# include "rrd.h"
+# include "store.h"
+
+
+/* Writer */
+/* types */
+typedef struct _Writer Writer;
+
+typedef enum _WriterPolicy
+{
+	WRITERPOLICY_BLOCK = 0,			/* wait for room in the queue */
+	WRITERPOLICY_DROP			/* drop the oldest sample */
+} WriterPolicy;
+
+
+/* functions */
+Writer * writer_new(RRD * rrd, Store * store, size_t queue,
+		WriterPolicy policy, unsigned int delay);
+void writer_delete(Writer * writer);
+
+/* accessors */
+unsigned long writer_get_dropped(Writer * writer);
+
+/* useful */
+int writer_push(Writer * writer, RRDSample const * sample, char const * name);
+
+#endif /* !DAMON_WRITER_H */